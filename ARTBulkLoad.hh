@@ -0,0 +1,167 @@
+#pragma once
+
+#include "OptimisticLockCoupling/Tree.h"
+#include "ARTRoot.hh"
+#include "Key.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/*
+ *    Bottom-up construction of an ART_OLC tree from a sorted key stream
+ *    ------------------------------------------------------------------
+ *    Every inner node is created once, at the size that fits its fanout
+ *    (N4/N16/N48/N256), with its full compressed prefix, and children are
+ *    added in key order. The tree being built must not be reachable by
+ *    other threads, so no node locks are taken; publish it afterwards
+ *    (see HybridART::bulkLoadRO).
+ */
+
+class ARTBulkLoader {
+public:
+    using LoadKeyFunction = ART_OLC::Tree::LoadKeyFunction;
+
+    // Fills the empty, unpublished `tree` with the `n` TIDs in `tids`,
+    // which must be sorted by key and name distinct keys, none of which is
+    // a prefix of another (as ART_OLC requires). Returns false, leaving
+    // the tree empty, if that does not hold.
+    static bool build(ART_OLC::Tree& tree, const TID* tids, std::size_t n, LoadKeyFunction loadKey){
+        ARTBulkLoader b(tids, n, loadKey);
+        if(!b.valid_)
+            return false;
+        std::vector<std::pair<uint8_t, N*>> children;
+        std::size_t lo = 0;
+        while(lo < n){
+            N* child = nullptr;
+            std::size_t hi = lo + 1;
+            if(b.len(lo) > 0){
+                uint8_t c = b.key(lo)[0];
+                while(hi < n && b.key(hi)[0] == c)
+                    hi++;
+                child = b.build_node(lo, hi, 1);
+            }
+            if(!child){
+                for(auto& x : children)
+                    delete_subtree(x.second);
+                return false;
+            }
+            children.push_back(std::make_pair(b.key(lo)[0], child));
+            lo = hi;
+        }
+        N* root = art_root(tree);
+        for(auto& x : children)
+            static_cast<N256*>(root)->insert(x.first, x.second);
+        return true;
+    }
+
+private:
+    const TID* tids_;
+    // keys, loaded once and packed into one buffer
+    std::vector<uint8_t> bytes_;
+    std::vector<std::size_t> off_;
+    std::vector<uint32_t> len_;
+    // keys are non-empty, strictly increasing and prefix-free
+    bool valid_;
+
+    ARTBulkLoader(const TID* tids, std::size_t n, LoadKeyFunction loadKey)
+        : tids_(tids), off_(n), len_(n), valid_(true) {
+        for(std::size_t i = 0; i < n; i++){
+            Key k;
+            loadKey(tids[i], k);
+            off_[i] = bytes_.size();
+            len_[i] = k.getKeyLen();
+            bytes_.insert(bytes_.end(), &k[0], &k[0] + k.getKeyLen());
+        }
+        // in sorted order a key that prefixes any later key prefixes the
+        // next one, so checking neighbours is enough
+        for(std::size_t i = 0; i < n && valid_; i++){
+            if(len(i) == 0)
+                valid_ = false;
+            else if(i > 0){
+                uint32_t l = std::min(len(i - 1), len(i));
+                int c = memcmp(key(i - 1), key(i), l);
+                valid_ = c < 0;
+            }
+        }
+    }
+
+    const uint8_t* key(std::size_t i) const {
+        return &bytes_[off_[i]];
+    }
+    uint32_t len(std::size_t i) const {
+        return len_[i];
+    }
+
+    static void delete_subtree(N* n){
+        if(!N::isLeaf(n)){
+            N::deleteChildren(n);
+            N::deleteNode(n);
+        }
+    }
+
+    static N* new_node(unsigned fanout, const uint8_t* prefix, uint32_t prefix_len){
+        if(fanout <= 4)
+            return new N4(prefix, prefix_len);
+        else if(fanout <= 16)
+            return new N16(prefix, prefix_len);
+        else if(fanout <= 48)
+            return new N48(prefix, prefix_len);
+        else
+            return new N256(prefix, prefix_len);
+    }
+
+    static void add_child(N* n, uint8_t keyslice, N* child){
+        switch(n->getType()){
+            case NTypes::N4:
+                static_cast<N4*>(n)->insert(keyslice, child);
+                break;
+            case NTypes::N16:
+                static_cast<N16*>(n)->insert(keyslice, child);
+                break;
+            case NTypes::N48:
+                static_cast<N48*>(n)->insert(keyslice, child);
+                break;
+            case NTypes::N256:
+                static_cast<N256*>(n)->insert(keyslice, child);
+                break;
+        }
+    }
+
+    // Builds the subtree for keys [lo, hi), which agree on their first
+    // `depth` bytes. Returns nullptr if a key ends inside the subtree.
+    N* build_node(std::size_t lo, std::size_t hi, uint32_t depth){
+        if(hi - lo == 1) // lazy expansion: a single key is a leaf
+            return N::setLeaf(tids_[lo]);
+        // keys are sorted, so the first and last key bound the common prefix
+        const uint8_t* a = key(lo);
+        const uint8_t* b = key(hi - 1);
+        uint32_t la = len(lo), lb = len(hi - 1);
+        uint32_t p = depth;
+        while(p < la && p < lb && a[p] == b[p])
+            p++;
+        if(p >= la) // unreachable: the constructor checked prefix-freedom
+            return nullptr;
+
+        unsigned fanout = 1;
+        for(std::size_t i = lo + 1; i < hi; i++)
+            if(key(i)[p] != key(i - 1)[p])
+                fanout++;
+        N* n = new_node(fanout, a + depth, p - depth);
+
+        std::size_t s = lo;
+        while(s < hi){
+            uint8_t c = key(s)[p];
+            std::size_t e = s + 1;
+            while(e < hi && key(e)[p] == c)
+                e++;
+            N* child = build_node(s, e, p + 1);
+            if(!child){
+                delete_subtree(n);
+                return nullptr;
+            }
+            add_child(n, c, child);
+            s = e;
+        }
+        return n;
+    }
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "OptimisticLockCoupling/Tree.h"
+#include <cassert>
+#include <type_traits>
+
+// ART_OLC::Tree keeps its root N256 private and has no accessor. The root
+// pointer is Tree's first member, so code that needs to walk the tree
+// itself (TART's range cursor, ARTBulkLoader) reads it through this one
+// helper; it checks what it can of that layout.
+inline ART_OLC::N* art_root(ART_OLC::Tree& tree){
+    static_assert(!std::is_polymorphic<ART_OLC::Tree>::value,
+                  "ART_OLC::Tree's root must be at offset 0");
+    static_assert(sizeof(ART_OLC::Tree) >= sizeof(ART_OLC::N*),
+                  "ART_OLC::Tree must start with its root pointer");
+    auto root = *reinterpret_cast<ART_OLC::N**>(&tree);
+    assert(root && !ART_OLC::N::isLeaf(root)
+           && root->getType() == ART_OLC::NTypes::N256);
+    return root;
+}
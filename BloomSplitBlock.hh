@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*
+ *    Split-block bloom filter
+ *    ------------------------
+ *    The filter is an array of 256-bit blocks, one per 32-byte half cache
+ *    line. A key hashes to a single block and sets one bit in each of the
+ *    block's eight 32-bit words, so a probe touches one cache line and,
+ *    with AVX2, tests all eight bits with a multiply, a shift and a
+ *    vptest. Drop-in for BloomPacking/BloomNoPacking as the BloomT of
+ *    TART/ExtendedART/HybridART:
+ *
+ *    contains(key, len, hashVal) probes `key` and, if hashVal is not null,
+ *    stores its hash there (2 words) so that BLOOM_VALIDATE can re-probe
+ *    it with contains_hash() at commit time without reloading the key.
+ *
+ *    Inserts set bits with atomic fetch_or; probes read the block with
+ *    plain loads, since bits are only ever set.
+ */
+
+#ifndef BLOOM_SPLIT_BLOCK_LOG_BLOCKS
+// 2^21 blocks = 64MB, ~13 bits/key at the 40M keys of test_meme
+#define BLOOM_SPLIT_BLOCK_LOG_BLOCKS 21
+#endif
+
+class BloomSplitBlock {
+public:
+    explicit BloomSplitBlock(unsigned log_blocks = BLOOM_SPLIT_BLOCK_LOG_BLOCKS)
+        : log_blocks_(log_blocks), blocks_(allocate(log_blocks)) {
+    }
+    BloomSplitBlock(const BloomSplitBlock& x)
+        : log_blocks_(x.log_blocks_), blocks_(allocate(x.log_blocks_)) {
+        copy_bits(x);
+    }
+    ~BloomSplitBlock() {
+        free(blocks_);
+    }
+    // copyable, like the other filters
+    BloomSplitBlock& operator=(const BloomSplitBlock& x) {
+        if (this != &x) {
+            if (log_blocks_ != x.log_blocks_) {
+                free(blocks_);
+                log_blocks_ = x.log_blocks_;
+                blocks_ = allocate(log_blocks_);
+            }
+            copy_bits(x);
+        }
+        return *this;
+    }
+
+    void insert(const uint8_t* key, uint32_t len) {
+        uint64_t h = hash(key, len);
+        block* b = &blocks_[block_index(h)];
+        uint32_t m[8];
+        make_mask(uint32_t(h), m);
+        for (int i = 0; i < 8; ++i)
+            b->w[i].fetch_or(m[i], std::memory_order_relaxed);
+    }
+    bool contains(const uint8_t* key, uint32_t len, uint64_t* hashVal) {
+        uint64_t h = hash(key, len);
+        if (hashVal) {
+            hashVal[0] = h;
+            hashVal[1] = 0;
+        }
+        return probe(h);
+    }
+    bool contains_hash(uint64_t* hashVal) {
+        return probe(hashVal[0]);
+    }
+
+    // the size (log2 of the number of blocks) for about `keys` keys
+    static unsigned log_blocks_for(size_t keys, unsigned bits_per_key = 12) {
+        size_t blocks = (keys * bits_per_key + 255) / 256;
+        unsigned log_blocks = 0;
+        while ((size_t(1) << log_blocks) < blocks)
+            ++log_blocks;
+        return log_blocks;
+    }
+
+    void clear() {
+        memset(static_cast<void*>(blocks_), 0, sizeof(block) << log_blocks_);
+    }
+    size_t size_bytes() const {
+        return sizeof(block) << log_blocks_;
+    }
+
+private:
+    struct block {
+        std::atomic<uint32_t> w[8];
+    } __attribute__((aligned(32)));
+
+    unsigned log_blocks_;
+    block* blocks_;
+
+    static block* allocate(unsigned log_blocks) {
+        void* p;
+        if (posix_memalign(&p, 64, sizeof(block) << log_blocks) != 0)
+            throw std::bad_alloc();
+        memset(p, 0, sizeof(block) << log_blocks);
+        return static_cast<block*>(p);
+    }
+    void copy_bits(const BloomSplitBlock& x) {
+        memcpy(static_cast<void*>(blocks_), static_cast<const void*>(x.blocks_),
+               sizeof(block) << log_blocks_);
+    }
+
+    // odd multipliers from the Parquet/Impala split-block filters
+    static constexpr uint32_t salt0 = 0x47b6137bU, salt1 = 0x44974d91U,
+        salt2 = 0x8824ad5bU, salt3 = 0xa2b7289dU, salt4 = 0x705495c7U,
+        salt5 = 0x2df1424bU, salt6 = 0x9efc4947U, salt7 = 0x5c6bfb31U;
+
+    static uint64_t hash(const uint8_t* key, uint32_t len) {
+        // 8 bytes at a time, finished with the murmur3 64-bit mixer
+        uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0xff51afd7ed558ccdULL);
+        uint32_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+            uint64_t w;
+            memcpy(&w, key + i, 8);
+            h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 29;
+        }
+        if (i < len) {
+            uint64_t w = 0;
+            memcpy(&w, key + i, len - i);
+            h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    // high hash bits pick the block, the low 32 bits pick the bits within it
+    size_t block_index(uint64_t h) const {
+        return size_t(h >> 32) & ((size_t(1) << log_blocks_) - 1);
+    }
+    static void make_mask(uint32_t k, uint32_t* m) {
+        static const uint32_t salts[8] = {salt0, salt1, salt2, salt3,
+                                          salt4, salt5, salt6, salt7};
+        for (int i = 0; i < 8; ++i)
+            m[i] = uint32_t(1) << ((k * salts[i]) >> 27);
+    }
+
+    bool probe(uint64_t h) const {
+        const block* b = &blocks_[block_index(h)];
+#ifdef __AVX2__
+        const __m256i salts = _mm256_setr_epi32(salt0, salt1, salt2, salt3,
+                                                salt4, salt5, salt6, salt7);
+        __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(uint32_t(h)), salts), 27);
+        __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+        __m256i words = _mm256_load_si256(reinterpret_cast<const __m256i*>(b));
+        // all mask bits set in the block <=> (~words & mask) == 0
+        return _mm256_testc_si256(words, mask);
+#else
+        uint32_t m[8];
+        make_mask(uint32_t(h), m);
+        for (int i = 0; i < 8; ++i)
+            if ((b->w[i].load(std::memory_order_relaxed) & m[i]) != m[i])
+                return false;
+        return true;
+#endif
+    }
+};
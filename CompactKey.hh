@@ -0,0 +1,173 @@
+#pragma once
+
+#include "Transaction.hh"
+#include "Key.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+/*
+ *    Compact key copies for TART
+ *    ---------------------------
+ *    TART keeps a copy of every key a transaction found absent (absent
+ *    key lists, key set, range set) until the transaction is over. An ART
+ *    Key carries a 128-byte inline buffer, so a heap `Key` per entry costs
+ *    ~150 bytes plus malloc overhead even for 10-byte keys. A compact_key
+ *    is 24 bytes: keys of up to compact_key::inline_cap bytes live inside
+ *    it, longer keys in a per-thread bump arena.
+ *
+ *    Everything allocated from the arena lives until the transaction that
+ *    allocated it is over. When a thread fills its chunk it hands the
+ *    chunk to Transaction::rcu_free and starts a new one, so the chunk is
+ *    reclaimed once every transaction running at that point has finished.
+ */
+
+class key_arena {
+public:
+    static constexpr size_t chunk_size = 64 << 10;
+
+    // `n` bytes, 8-byte aligned, valid until the current transaction is over
+    static void* alloc(size_t n) {
+        n = (n + 7) & ~size_t(7);
+        thread_state& ts = state();
+        if (n > chunk_size / 4) {
+            // too big to share a chunk
+            void* p = checked_malloc(n);
+            Transaction::rcu_free(p);
+            return p;
+        }
+        if (n > ts.left) {
+            if (ts.chunk)
+                Transaction::rcu_free(ts.chunk);
+            ts.chunk = static_cast<char*>(checked_malloc(chunk_size));
+            ts.cur = ts.chunk;
+            ts.left = chunk_size;
+        }
+        void* p = ts.cur;
+        ts.cur += n;
+        ts.left -= n;
+        return p;
+    }
+    template <typename T>
+    static T* make() {
+        return new (alloc(sizeof(T))) T();
+    }
+
+    // memory accounting for key copies, per thread
+    struct stats {
+        uint64_t keys;          // keys copied
+        uint64_t inline_keys;   // of which short enough to be inline
+        uint64_t key_bytes;     // key bytes copied
+        uint64_t compact_bytes; // compact_key objects plus arena bytes
+        uint64_t heap_bytes;    // what a heap Key per copy would have taken
+    };
+    static void account(uint32_t len, bool is_inline, size_t size) {
+        stats& s = state().st;
+        ++s.keys;
+        s.inline_keys += is_inline;
+        s.key_bytes += len;
+        s.compact_bytes += size;
+        // ART Keys longer than their 128-byte stack buffer go to the heap
+        s.heap_bytes += sizeof(Key) + (len > 128 ? len : 0);
+    }
+    // sum over all threads; call once the workers are done
+    static stats total() {
+        stats t;
+        memset(&t, 0, sizeof(t));
+        for (int i = 0; i < MAX_THREADS; ++i) {
+            const stats& s = states()[i].st;
+            t.keys += s.keys;
+            t.inline_keys += s.inline_keys;
+            t.key_bytes += s.key_bytes;
+            t.compact_bytes += s.compact_bytes;
+            t.heap_bytes += s.heap_bytes;
+        }
+        return t;
+    }
+    static void print_report(FILE* f) {
+        stats t = total();
+        if (!t.keys)
+            return;
+        fprintf(f, "Key copies: %lu (%lu inline), %.1f key bytes/key, "
+                "%.1f bytes/key compact vs %.1f bytes/key as heap Keys\n",
+                (unsigned long) t.keys, (unsigned long) t.inline_keys,
+                double(t.key_bytes) / t.keys, double(t.compact_bytes) / t.keys,
+                double(t.heap_bytes) / t.keys);
+    }
+
+private:
+    struct thread_state {
+        char* chunk;
+        char* cur;
+        size_t left;
+        stats st;
+    } __attribute__((aligned(128)));
+
+    static thread_state* states() {
+        static thread_state s[MAX_THREADS];
+        return s;
+    }
+    static thread_state& state() {
+        return states()[TThread::id()];
+    }
+    static void* checked_malloc(size_t n) {
+        void* p = malloc(n);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+};
+
+class compact_key {
+public:
+    static constexpr uint32_t inline_cap = 16;
+
+    compact_key()
+        : len_(0) {
+    }
+    explicit compact_key(const Key& k) {
+        assign(k);
+    }
+    // copies k's bytes; long keys go to the arena
+    void assign(const Key& k) {
+        len_ = k.getKeyLen();
+        const uint8_t* bytes = &k[0];
+        if (len_ <= inline_cap)
+            memcpy(u_.bytes, bytes, len_);
+        else {
+            uint8_t* p = static_cast<uint8_t*>(key_arena::alloc(len_));
+            memcpy(p, bytes, len_);
+            u_.ptr = p;
+        }
+        key_arena::account(len_, len_ <= inline_cap,
+                           sizeof(compact_key) + (len_ <= inline_cap ? 0 : ((len_ + 7) & ~7U)));
+    }
+    // a compact_key allocated from the arena
+    static compact_key* make(const Key& k) {
+        compact_key* ck = static_cast<compact_key*>(key_arena::alloc(sizeof(compact_key)));
+        new (ck) compact_key(k);
+        return ck;
+    }
+
+    const uint8_t* data() const {
+        return len_ <= inline_cap ? u_.bytes : u_.ptr;
+    }
+    uint32_t size() const {
+        return len_;
+    }
+    void load(Key& k) const {
+        k.set(reinterpret_cast<const char*>(data()), len_);
+    }
+    bool operator==(const Key& k) const {
+        return len_ == k.getKeyLen() && memcmp(data(), &k[0], len_) == 0;
+    }
+
+private:
+    uint32_t len_;
+    union {
+        uint8_t bytes[inline_cap];
+        const uint8_t* ptr;
+    } u_;
+};
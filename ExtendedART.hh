@@ -2,11 +2,18 @@
 
 #include "TART.hh"
 #include "../util/bloom.hh"
+#include "BloomSplitBlock.hh"
 #include "OptimisticLockCoupling/Tree.h"
 
 
 #define MEASURE_BF_FALSE_POSITIVES 1
 
+// Lookups per thread between two decisions of the adaptive lookup policy
+#define ADAPTIVE_EPOCH_LOOKUPS 4096
+// Under the adaptive policy one in this many misses of a double-lookup
+// epoch also probes the bloom filter, to keep its false-positive rate known
+#define ADAPTIVE_FP_SAMPLE 16
+
 // needed for the range query when we merge. We store the
 // result TIDs in an array and then insert all these keys
 // into RO
@@ -14,12 +21,32 @@
 
 
 
+// How lookups use the bloom filter: always probe it first (bloom), never
+// probe it and always look up RW (double_lookup), or choose one of the
+// two per thread and epoch from the observed hit ratio and bloom false
+// positives (adaptive). Only matters when BloomT is not DoubleLookup.
+enum class lookup_policy { bloom, double_lookup, adaptive };
+
 template <typename T, typename BloomT> class ExtendedART{
 protected:
     TART<T, BloomT> tart;
     
     BloomT bloom;
 
+    lookup_policy policy;
+    // a bloom epoch must answer at least this fraction of its lookups
+    // from the filter alone (true negatives) for bloom to stay chosen
+    double adaptive_min_skip;
+
+    // per-thread state of the adaptive policy for the current epoch
+    struct adaptive_state {
+        bool use_bloom;
+        uint64_t lookups, found;
+        uint64_t negatives, fps;    // absent keys probed in the bloom, and its false positives
+        uint64_t epochs, bloom_epochs;
+    } __attribute__((aligned(128)));
+    adaptive_state adaptive[N_THREADS];
+
 
 inline bool is_using_bloom(){
     return !std::is_same<BloomT, DoubleLookup>::value;
@@ -31,11 +58,33 @@ public:
     int BF_false_positives[N_THREADS][2] __attribute__((aligned(128)));
 #endif
 
-    ExtendedART(Tree::LoadKeyFunction TARTloadKeyFun): tart(TARTloadKeyFun, bloom)
+    ExtendedART(Tree::LoadKeyFunction TARTloadKeyFun): tart(TARTloadKeyFun, bloom),
+        policy(lookup_policy::bloom), adaptive_min_skip(0.3)
     {
         #if MEASURE_BF_FALSE_POSITIVES == 1
             bzero(BF_false_positives, N_THREADS * 2 * sizeof(int));
         #endif
+        bzero(adaptive, N_THREADS * sizeof(adaptive_state));
+        for(unsigned i=0; i<N_THREADS; i++)
+            adaptive[i].use_bloom = true;
+    }
+
+    void set_lookup_policy(lookup_policy p){
+        policy = p;
+    }
+    void set_adaptive_min_skip(double min_skip){
+        adaptive_min_skip = min_skip;
+    }
+    // epochs decided so far over all threads, and how many chose bloom
+    uint64_t adaptive_epochs(uint64_t* bloom_epochs = nullptr) const {
+        uint64_t n = 0, b = 0;
+        for(unsigned i=0; i<N_THREADS; i++){
+            n += adaptive[i].epochs;
+            b += adaptive[i].bloom_epochs;
+        }
+        if(bloom_epochs)
+            *bloom_epochs = b;
+        return n;
     }
 
     ~ExtendedART(){
@@ -54,8 +103,9 @@ public:
     // Lookup a key with given key index. Lookup will be performed in both RW and RO, if necessary. The key index is 
     // required to guarantee key uniqueness for the bloom filter validation. We do this instead of performing a hash of the key.
     lookup_res lookup(const Key& k, uint64_t key_ind, ThreadInfo& t, unsigned thread_id){
-        (void)thread_id;
-        if(is_using_bloom()){
+        if(is_using_bloom() && policy == lookup_policy::adaptive)
+            return adaptive_lookup(k, key_ind, t, thread_id);
+        if(is_using_bloom() && policy == lookup_policy::bloom){
             bool contains = false;
             uint64_t hashVal[2];
             contains = bloom.contains(k.getKey(), k.getKeyLen(), hashVal);
@@ -95,6 +145,58 @@ public:
         }
     }
 
+    // One lookup under the adaptive policy. The bloom filter is kept up
+    // to date in every epoch, so either strategy is correct at any time
+    // and a transaction may mix them: each lookup is validated by its
+    // own strategy (bloom set or node set).
+    lookup_res adaptive_lookup(const Key& k, uint64_t key_ind, ThreadInfo& t, unsigned thread_id){
+        adaptive_state& a = adaptive[thread_id];
+        lookup_res l_res;
+        if(a.use_bloom){
+            uint64_t hashVal[2];
+            if(!bloom.contains(k.getKey(), k.getKeyLen(), hashVal)){
+                tart.bloom_v_add_key(key_ind, hashVal);
+                ++a.negatives;
+                l_res = std::make_tuple(0, true);
+            } else {
+                l_res = tart.t_lookup(k, t);
+                if(!std::get<1>(l_res))
+                    return l_res;
+                if(std::get<0>(l_res) == 0){
+                    ++a.negatives;
+                    ++a.fps;
+                }
+            }
+        } else {
+            l_res = tart.t_lookup(k, t);
+            if(!std::get<1>(l_res))
+                return l_res;
+            if(std::get<0>(l_res) == 0 && (a.lookups % ADAPTIVE_FP_SAMPLE) == 0){
+                ++a.negatives;
+                if(bloom.contains(k.getKey(), k.getKeyLen(), nullptr))
+                    ++a.fps;
+            }
+        }
+        if(std::get<0>(l_res) != 0)
+            ++a.found;
+        if(++a.lookups == ADAPTIVE_EPOCH_LOOKUPS)
+            adaptive_decide(a);
+        return l_res;
+    }
+
+    // Ends the thread's epoch: bloom pays off when the share of lookups
+    // it answers alone, misses * (1 - false positive rate), is high
+    // enough to cover the probe on every other lookup.
+    void adaptive_decide(adaptive_state& a){
+        double miss = 1.0 - (double) a.found / a.lookups;
+        double fp_rate = a.negatives ? (double) a.fps / a.negatives : 0;
+        a.use_bloom = miss * (1 - fp_rate) >= adaptive_min_skip;
+        ++a.epochs;
+        if(a.use_bloom)
+            ++a.bloom_epochs;
+        a.lookups = a.found = a.negatives = a.fps = 0;
+    }
+
     ins_res insert(const Key& k, TID tid, ThreadInfo& t, unsigned thread_id){
         return insert(k, tid, t, false, thread_id);
     }
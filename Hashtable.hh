@@ -1,7 +1,8 @@
 #pragma once
 #include "config.h"
 #include "compiler.hh"
-// XXX: honestly hashtable should probably use local_vector too
+#include <atomic>
+#include <thread>
 #include <vector>
 #include "Interface.hh"
 #include "Transaction.hh"
@@ -67,22 +68,69 @@ private:
     bucket_entry() : head(NULL), version(0) {}
   };
 
-  typedef std::vector<bucket_entry> MapType;
+  // the table grows online. Resizing doubles the number of buckets into a
+  // new bucket_table whose `prev` is the old one; operations that insert
+  // then each migrate a few old buckets. An old bucket that has been
+  // migrated is empty and has moved_bit set in its version, so lookups
+  // that land on it go on to the new table. Migrating a bucket bumps its
+  // version, so a transaction that saw a key absent there before the move
+  // fails validation, as it would for an insert.
+  struct bucket_table {
+    size_t nbuckets;
+    bucket_entry* buckets;
+    // the table being migrated into this one, if any
+    std::atomic<bucket_table*> prev;
+    std::atomic<size_t> migrate_next; // next prev bucket to claim
+    std::atomic<size_t> migrated;     // prev buckets done
+    bucket_table(size_t n, bucket_table* p)
+      : nbuckets(n), buckets(new bucket_entry[n]), prev(p), migrate_next(0), migrated(0) {}
+    ~bucket_table() {
+      delete[] buckets;
+    }
+    bucket_entry& at(size_t h) {
+      return buckets[h % nbuckets];
+    }
+  };
+
+  // element count, kept per thread and summed when deciding to resize;
+  // padded to a cache line (Hashtables are plain `new`ed, so no aligned())
+  struct thread_count {
+    ssize_t n;
+    unsigned inserts;
+    char pad_[64 - sizeof(ssize_t) - sizeof(unsigned)];
+  };
+
   // this is the hashtable itself, an array of bucket_entry's
-  MapType map_;
+  std::atomic<bucket_table*> table_;
   Hash hasher_;
   Pred pred_;
+  // resize once there are more than max_load_ elements per bucket (0: never)
+  double max_load_;
+  thread_count counts_[MAX_THREADS];
+
+  // every thread checks the load after this many inserts
+  static constexpr unsigned resize_check_interval = 256;
+  // old buckets an insert migrates while a resize is underway
+  static constexpr size_t migrate_batch = 16;
 
   // used to mark whether a key is a bucket (for bucket version checks)
   // or a pointer (which will always have the lower 3 bits as 0)
   static constexpr uintptr_t bucket_bit = 1U<<0;
+  // set in the version of a bucket that has been migrated to a newer table
+  static constexpr typename Version_type::type moved_bit = TransactionTid::user_bit;
 
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
 
 public:
-  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred()) : map_(), hasher_(h), pred_(p) {
-    map_.resize(size);
+  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred())
+    : table_(new bucket_table(size ? size : 1, NULL)), hasher_(h), pred_(p), max_load_(2) {
+    memset(static_cast<void*>(counts_), 0, sizeof(counts_));
+  }
+  ~Hashtable() {
+    bucket_table* t = table_.load();
+    delete t->prev.load();
+    delete t;
   }
 
   inline size_t hash(const Key& k) {
@@ -90,21 +138,39 @@ public:
   }
 
   inline size_t nbuckets() {
-    return map_.size();
+    return table_.load(std::memory_order_acquire)->nbuckets;
   }
 
-  inline size_t bucket(const Key& k) {
-    return hash(k) % nbuckets();
+  // approximate number of elements
+  size_t size() const {
+    ssize_t n = 0;
+    for (int i = 0; i < MAX_THREADS; ++i)
+      n += counts_[i].n;
+    return n > 0 ? n : 0;
+  }
+
+  // resize when the average chain gets longer than `load` (0 disables resizing)
+  void set_max_load(double load) {
+    max_load_ = load;
+  }
+
+  // finishes a resize that is underway. Inserts drive migration, so a
+  // table that stops growing mid-resize keeps looking in both tables
+  // until someone calls this.
+  void finish_resize() {
+    epoch_pin pin;
+    bucket_table* t = table_.load(std::memory_order_acquire);
+    while (t->prev.load(std::memory_order_acquire))
+      help_resize(t);
   }
 
 #ifndef STO_NO_STM
   // returns true if found false if not
   template <typename KT, typename VT>
   bool transGet(const KT& k, VT& retval) {
-    bucket_entry& buck = buck_entry(k);
-    Version_type buck_version = buck.version;
-    fence();
-    internal_elem *e = find(buck, k);
+    bucket_entry* buck;
+    Version_type buck_version;
+    internal_elem *e = find_current(k, buck, buck_version);
     if (e) {
       auto item = t_read_only_item(e);
       if (!validity_check(item, e)) {
@@ -131,7 +197,7 @@ public:
       retval = e->value.read(item, e->version);
       return true;
     } else {
-      Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
+      Sto::item(this, pack_bucket(buck)).observe(Version_type(buck_version.unlocked()));
       //if (Opacity)
       //  check_opacity(buck.version);
       return false;
@@ -141,10 +207,9 @@ public:
 #if HASHTABLE_DELETE
   // returns true if successful
   bool transDelete(const Key& k) {
-    bucket_entry& buck = buck_entry(k);
-    Version_type buck_version = buck.version;
-    fence();
-    internal_elem *e = find(buck, k);
+    bucket_entry* buck;
+    Version_type buck_version;
+    internal_elem *e = find_current(k, buck, buck_version);
     if (e) {
       Version_type elemvers = e->version;
       fence();
@@ -158,7 +223,7 @@ public:
         // so we just unmark all attributes so the item is ignored
         item.remove_read().remove_write().clear_flags(insert_bit | delete_bit);
         // insert-then-delete still can only succeed if no one else inserts this node so we add a check for that
-        Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
+        Sto::item(this, pack_bucket(buck)).observe(Version_type(buck_version.unlocked()));
         return true;
       } else
 #endif
@@ -183,7 +248,7 @@ public:
       return true;
     } else {
       // add a read that yes this element doesn't exist
-      Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
+      Sto::item(this, pack_bucket(buck)).observe(Version_type(buck_version.unlocked()));
       //if (Opacity)
       //  check_opacity(buck.version);
       return false;
@@ -196,11 +261,10 @@ private:
   template <bool INSERT, bool SET, typename KT, typename VT>
   bool trans_write(const KT& k, const VT& v) {
     // TODO: technically puts don't need to look into the table at all until lock time
-    bucket_entry& buck = buck_entry(k);
     // TODO: update doesn't need to lock the table
     // also we should lock the head pointer instead so we don't
     // mess with tids
-    lock(buck.version);
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (e) {
       unlock(buck.version);
@@ -247,7 +311,7 @@ private:
         auto buck_vers = buck.version.unlocked();
         fence();
         unlock(buck.version);
-        Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_vers));
+        Sto::item(this, pack_bucket(&buck)).observe(Version_type(buck_vers));
         //if (Opacity)
         //    check_opacity(buck.version);
         return false;
@@ -261,7 +325,7 @@ private:
       fence();
       unlock(buck.version);
       // see if this item was previously read
-      auto bucket_item = Sto::check_item(this, pack_bucket(bucket(k)));
+      auto bucket_item = Sto::check_item(this, pack_bucket(&buck));
       if (bucket_item) {
         bucket_item->update_read(Version_type(prev_version), Version_type(new_version));
         //} else { could abort transaction now
@@ -273,6 +337,7 @@ private:
       item.template add_write<write_value_type>(v);
       // need to remove this item if we abort
       item.add_flags(insert_bit);
+      note_insert();
       return false;
     }
   }
@@ -297,7 +362,7 @@ public:
 
   bool check(TransItem& item, Transaction&) override {
     if (is_bucket(item)) {
-      bucket_entry& buck = map_[bucket_key(item)];
+      bucket_entry& buck = *bucket_key(item);
       return buck.version.check_version(item.template read_value<Version_type>());
     }
     auto el = item.key<internal_elem*>();
@@ -342,8 +407,7 @@ public:
 #if 1
     // convert nonopaque bucket version to a commit tid
     if (Opacity && has_insert(item)) {
-      bucket_entry& buck = buck_entry(el->key);
-      lock(buck.version);
+      bucket_entry& buck = lock_bucket(el->key);
       // only update if it's still nonopaque. Otherwise someone with a higher tid
       // could've already updated it.
       if (buck.version.value() & TransactionTid::nonopaque_bit)
@@ -393,8 +457,9 @@ public:
     int max_chaining = 0;
     int num_empty = 0;
 
-    for (unsigned i = 0; i < map_.size(); ++i) {
-      bucket_entry& buck = map_[i];
+    size_t n = total_buckets();
+    for (unsigned i = 0; i < n; ++i) {
+      bucket_entry& buck = *nth_bucket(i);
       if (!buck.head) {
         num_empty++;
         continue;
@@ -410,7 +475,7 @@ public:
       if (ct > max_chaining) max_chaining = ct;
     }
 
-    printf("Total count: %d, Empty buckets: %d, Avg chaining: %f, Max chaining: %d\n", tot_count, num_empty, ((double)(tot_count))/(map_.size() - num_empty), max_chaining);
+    printf("Total count: %d, Empty buckets: %d, Avg chaining: %f, Max chaining: %d\n", tot_count, num_empty, ((double)(tot_count))/(n - num_empty), max_chaining);
   }
 
     void print(std::ostream& w, const TransItem& item) const override {
@@ -432,8 +497,8 @@ public:
 
   void print() {
     printf("Hashtable:\n");
-    for (unsigned i = 0; i < map_.size(); ++i) {
-      bucket_entry& buck = map_[i];
+    for (unsigned i = 0; i < total_buckets(); ++i) {
+      bucket_entry& buck = *nth_bucket(i);
       if (!buck.head)
         continue;
       printf("bucket %d (version %d): ", i, buck.version);
@@ -458,8 +523,8 @@ public:
       if (node) {
         node = node->next;
       }
-      while (!node && bucket != table->map_.size()) {
-        node = table->map_[bucket].head;
+      while (!node && bucket != table->total_buckets()) {
+        node = table->nth_bucket(bucket)->head;
         bucket++;
       }
       return *this;
@@ -470,7 +535,7 @@ public:
     }
   private:
     const Hashtable *table;
-    int bucket;
+    size_t bucket;
     internal_elem *node;
     friend class Hashtable;
   };
@@ -478,21 +543,20 @@ public:
   const_iterator begin() const {
     const_iterator begin;
     begin.table = this;
-    begin.bucket = -1;
+    begin.bucket = 0;
     begin.node = NULL;
     return ++begin; //eh
   }
   const_iterator end() const {
     const_iterator end;
-    end.bucket = map_.size();
+    end.bucket = total_buckets();
     end.node = NULL;
     return end;
   }
 
   // remove given the internal element node. used by transaction system
   void _remove(internal_elem *el) {
-    bucket_entry& buck = buck_entry(el->key);
-    lock(buck.version);
+    bucket_entry& buck = lock_bucket(el->key);
     internal_elem *prev = NULL;
     internal_elem *cur = buck.head;
     while (cur != NULL && cur != el) {
@@ -506,13 +570,14 @@ public:
       buck.head = cur->next;
     }
     unlock(buck.version);
+    --counts_[TThread::id()].n;
     Transaction::rcu_delete(cur);
   }
 
   // non-txnal remove given a key
   bool remove(const Key& k) {
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    epoch_pin pin;
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *prev = NULL;
     internal_elem *cur = buck.head;
     while (cur != NULL && !pred_(cur->key, k)) {
@@ -528,14 +593,16 @@ public:
     } else {
       buck.head = cur->next;
     }
-    unlock(buck.version);    
+    unlock(buck.version);
+    --counts_[TThread::id()].n;
     // TODO(nate): this would probably work fine as-is
     // Transaction::rcu_free(cur);
     return true;
   }
 
   bool read(const Key& k, Value& retval) {
-    auto e = find(buck_entry(k), k);
+    epoch_pin pin;
+    auto e = elem(k);
     if (e) {
       // TODO(nate): this isn't safe for non-trivial types (need an atomic read)
       assign_val(retval, e->value.access());
@@ -552,7 +619,8 @@ public:
   }
 
   Value* readPtr(const Key& k) {
-    auto e = find(buck_entry(k), k);
+    epoch_pin pin;
+    auto e = elem(k);
     if (e) {
       return &e->value.access();
     }
@@ -562,23 +630,26 @@ public:
   // returns pointer to the value in the hashtable 
   // (no current way to distinguish if insert or set)
   Value* putIfAbsentPtr(const Key& k, const Value& val) {
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    epoch_pin pin;
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
-    if (!e) {
+    bool inserted = !e;
+    if (inserted) {
       insert_locked<true>(buck, k, val);
       e = buck.head;
     }
     Value *ret = &e->value.access();
     unlock(buck.version);
+    if (inserted)
+      note_insert();
     return ret;
   }
 
   // returns true if inserted. otherwise return false and val is set to current value.
   bool putIfAbsent(const Key& k, Value& val) {
+    epoch_pin pin;
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (e) {
       assign_val(val, e->value.access());
@@ -588,15 +659,17 @@ public:
       exists = false;
     }
     unlock(buck.version);
+    if (!exists)
+      note_insert();
     return exists;
   }
 
   // returns true if item already existed
   template <bool Insert = true, bool Set = true>
   bool put(const Key& k, const Value& val) {
+    epoch_pin pin;
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (e) {
       // XXX: kind of a stupid Set-only (still locks bucket)
@@ -609,6 +682,8 @@ public:
       exists = false;
     }
     unlock(buck.version);
+    if (Insert && !exists)
+      note_insert();
     return exists;
   }
 
@@ -616,9 +691,9 @@ public:
   // if item did exist, oldval is its old value
   template <bool Insert = true, bool Set = true>
   bool put_getold(const Key& k, const Value& val, Value& oldval) {
+    epoch_pin pin;
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (e) {
       assign_val(oldval, e->value.access());
@@ -632,6 +707,8 @@ public:
       exists = false;
     }
     unlock(buck.version);
+    if (Insert && !exists)
+      note_insert();
     return exists;
   }
 
@@ -652,6 +729,71 @@ public:
     unlock(e->version);
   }
 
+  // Loads n elements, gen(i) returning the i'th (key, value) pair, using
+  // nthreads threads. For populating a table before a run: no transaction
+  // may use the table meanwhile, and every element gets version
+  // Sto::initialized_tid(). The table is first grown to fit. Then each
+  // thread makes the elements for a slice of the input and sorts them by
+  // which thread's share of the buckets they hash to, and each thread
+  // links in its share, so no bucket is ever locked. Later duplicates of
+  // a key overwrite earlier ones. Returns the number of keys added.
+  template <typename F>
+  size_t bulk_load(size_t n, unsigned nthreads, F gen) {
+    finish_resize();
+    bucket_table* t = table_.load(std::memory_order_acquire);
+    size_t nb = t->nbuckets;
+    while (max_load_ > 0 && size() + n > nb * max_load_)
+      nb *= 2;
+    if (nb != t->nbuckets) {
+      table_.store(new bucket_table(nb, t), std::memory_order_release);
+      finish_resize();
+      t = table_.load(std::memory_order_acquire);
+    }
+    nthreads = std::max(nthreads, 1U);
+
+    // parts[p][q]: elements made by thread p for thread q's buckets
+    std::vector<std::vector<std::vector<internal_elem*>>> parts(nthreads);
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < nthreads; ++p)
+      threads.emplace_back([&, p] () {
+        auto& mine = parts[p];
+        mine.resize(nthreads);
+        for (size_t i = n * p / nthreads; i < n * (p + 1) / nthreads; ++i) {
+          auto kv = gen(i);
+          internal_elem* e = new internal_elem(kv.first, kv.second, true);
+          mine[owner(hash(e->key), t->nbuckets, nthreads)].push_back(e);
+        }
+      });
+    for (auto& th : threads)
+      th.join();
+
+    std::vector<size_t> added(nthreads, 0);
+    threads.clear();
+    for (unsigned q = 0; q < nthreads; ++q)
+      threads.emplace_back([&, q] () {
+        for (unsigned p = 0; p < nthreads; ++p)
+          for (internal_elem* e : parts[p][q]) {
+            bucket_entry& buck = t->at(hash(e->key));
+            if (internal_elem* old = find(buck, e->key)) {
+              old->value.access() = e->value.access();
+              delete e;
+            } else {
+              e->next = buck.head;
+              buck.head = e;
+              ++added[q];
+            }
+          }
+      });
+    for (auto& th : threads)
+      th.join();
+
+    size_t total = 0;
+    for (size_t a : added)
+      total += a;
+    counts_[TThread::id()].n += total;
+    return total;
+  }
+
   bool nontrans_insert(const Key& k, const Value& v) { return insert(k, v); }
 
   bool nontrans_find(const Key& k, Value& v) { return read(k, v); }
@@ -662,8 +804,149 @@ public:
   bool nontrans_remove(const Key& k, Value& oldval) { if (read(k,oldval)) return remove(k); else return false; }
 
 private:
-  bucket_entry& buck_entry(const Key& k) {
-    return map_[bucket(k)];
+  // the bucket that holds keys hashing to h, and its version when found
+  bucket_entry& read_bucket(size_t h, Version_type& vers) {
+    while (1) {
+      bucket_table* t = table_.load(std::memory_order_acquire);
+      if (bucket_table* o = t->prev.load(std::memory_order_acquire)) {
+        bucket_entry& buck = o->at(h);
+        vers = buck.version;
+        fence();
+        if (!(vers.value() & moved_bit))
+          return buck;
+      }
+      bucket_entry& buck = t->at(h);
+      vers = buck.version;
+      fence();
+      // t itself may have become the old table of a newer resize
+      if (!(vers.value() & moved_bit))
+        return buck;
+    }
+  }
+
+  // the bucket that holds k, locked
+  bucket_entry& lock_bucket(const Key& k) {
+    size_t h = hash(k);
+    while (1) {
+      Version_type vers;
+      bucket_entry& buck = read_bucket(h, vers);
+      lock(buck.version);
+      if (!(buck.version.value() & moved_bit))
+        return buck;
+      unlock(buck.version);
+    }
+  }
+
+  // looks up k without locking. A miss only counts if the bucket's
+  // version held still during the walk: migration relinks elements into
+  // the new table's chains, so a walk that overlaps it can wander off the
+  // old chain. Otherwise (e.g. the bucket moved) the lookup is retried.
+  template <typename KT>
+  internal_elem* find_current(const KT& k, bucket_entry*& buck, Version_type& vers) {
+    size_t h = hash(k);
+    while (1) {
+      buck = &read_bucket(h, vers);
+      internal_elem* e = find(*buck, k);
+      fence();
+      if (e)
+        return e;
+      Version_type v = buck->version;
+      if (v.value() == vers.value() && !v.is_locked())
+        return e;
+      relax_fence();
+    }
+  }
+
+  // Resizes free the old table through RCU. Non-transactional calls may
+  // run outside any transaction, so they pin an epoch while they look at
+  // buckets.
+  struct epoch_pin {
+    Transaction::epoch_type pinned;
+    epoch_pin() : pinned(Transaction::rcu_pin()) {}
+    ~epoch_pin() {
+      Transaction::rcu_unpin(pinned);
+    }
+  };
+
+  // called after each insert, with no bucket locked
+  void note_insert() {
+    thread_count& c = counts_[TThread::id()];
+    ++c.n;
+    bucket_table* t = table_.load(std::memory_order_acquire);
+    if (t->prev.load(std::memory_order_acquire))
+      help_resize(t);
+    else if (++c.inserts % resize_check_interval == 0 && max_load_ > 0
+             && size() > t->nbuckets * max_load_)
+      start_resize(t);
+  }
+
+  void start_resize(bucket_table* t) {
+    bucket_table* nt = new bucket_table(t->nbuckets * 2, t);
+    if (!table_.compare_exchange_strong(t, nt)) {
+      // someone else got there first
+      delete nt;
+      return;
+    }
+    help_resize(nt);
+  }
+
+  // migrates up to migrate_batch of t's old buckets
+  void help_resize(bucket_table* t) {
+    bucket_table* o = t->prev.load(std::memory_order_acquire);
+    if (!o)
+      return;
+    size_t b = t->migrate_next.fetch_add(migrate_batch);
+    if (b >= o->nbuckets)
+      return;
+    size_t e = std::min(b + migrate_batch, o->nbuckets);
+    for (size_t i = b; i != e; ++i)
+      migrate_bucket(o->buckets[i], t);
+    if (t->migrated.fetch_add(e - b) + (e - b) == o->nbuckets) {
+      t->prev.store(NULL, std::memory_order_release);
+      // transactions may still be looking at, or holding reads of, old buckets
+      Transaction::rcu_delete(o);
+    }
+  }
+
+  // moves buck's elements to their buckets in t and marks it moved
+  void migrate_bucket(bucket_entry& buck, bucket_table* t) {
+    lock(buck.version);
+    internal_elem* e = buck.head;
+    while (e) {
+      internal_elem* next = e->next;
+      bucket_entry& nbuck = t->at(hash(e->key));
+      lock(nbuck.version);
+      e->next = nbuck.head;
+      nbuck.head = e;
+      nbuck.version.inc_nonopaque_version();
+      unlock(nbuck.version);
+      e = next;
+    }
+    buck.head = NULL;
+    buck.version.inc_nonopaque_version();
+    buck.version.set_version_locked(buck.version | Version_type(moved_bit));
+    unlock(buck.version);
+  }
+
+  // the bulk_load thread whose share of the buckets holds hash h
+  static unsigned owner(size_t h, size_t nbuckets, unsigned nthreads) {
+    return (h % nbuckets) * nthreads / nbuckets;
+  }
+
+  // buckets for iteration: the old table's (if resizing), then the current one's
+  size_t total_buckets() const {
+    bucket_table* t = table_.load(std::memory_order_acquire);
+    bucket_table* o = t->prev.load(std::memory_order_acquire);
+    return (o ? o->nbuckets : 0) + t->nbuckets;
+  }
+  bucket_entry* nth_bucket(size_t i) const {
+    bucket_table* t = table_.load(std::memory_order_acquire);
+    if (bucket_table* o = t->prev.load(std::memory_order_acquire)) {
+      if (i < o->nbuckets)
+        return &o->buckets[i];
+      i -= o->nbuckets;
+    }
+    return &t->buckets[i];
   }
 
   // looks up a key's internal_elem, given its bucket
@@ -677,7 +960,9 @@ private:
 
   // looks up a key's internal_elem
   internal_elem* elem(const Key& k) {
-    return find(buck_entry(k), k);
+    bucket_entry* buck;
+    Version_type vers;
+    return find_current(k, buck, vers);
   }
 
   bool has_delete(const TransItem& item) {
@@ -707,12 +992,12 @@ private:
   static bool is_bucket(void* key) {
       return (uintptr_t)key & bucket_bit;
   }
-  static unsigned bucket_key(const TransItem& item) {
+  static bucket_entry* bucket_key(const TransItem& item) {
       assert(is_bucket(item));
-      return (uintptr_t) item.key<void*>() >> 1;
+      return (bucket_entry*) ((uintptr_t) item.key<void*>() & ~bucket_bit);
   }
-  void* pack_bucket(unsigned bucket) {
-      return (void*) ((bucket << 1) | bucket_bit);
+  static void* pack_bucket(bucket_entry* buck) {
+      return (void*) ((uintptr_t) buck | bucket_bit);
   }
 
   static bool is_locked(Version_type &v) {
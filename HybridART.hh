@@ -1,12 +1,21 @@
 #pragma once
 
 #include "TART.hh"
+#include "ARTBulkLoad.hh"
 #include "../util/bloom.hh"
+#include "BloomSplitBlock.hh"
 #include "OptimisticLockCoupling/Tree.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 
 #define MEASURE_BF_FALSE_POSITIVES 1
 
+// the smallest bloom generation, in keys
+#define BLOOM_GEN_MIN_KEYS (1 << 20)
+
 #if MEASURE_LATENCIES > 0
 extern double latencies_rw_lookup_found [N_THREADS][2] __attribute__((aligned(128)));
 extern double latencies_rw_lookup_not_found [N_THREADS][2] __attribute__((aligned(128)));
@@ -15,18 +24,89 @@ extern double latencies_rw_insert [N_THREADS][2] __attribute__((aligned(128)));
 #endif
 
 
-// needed for the range query when we merge. We store the
-// result TIDs in an array and then insert all these keys
-// into RO
-#define MAX_KEYS 20000000
 
+// A new bloom filter for about `keys` keys. Only BloomSplitBlock can be
+// sized; other filters have a fixed size.
+template <typename BloomT>
+inline BloomT* make_sized_bloom(std::size_t keys){
+    (void)keys;
+    return new BloomT();
+}
+template <>
+inline BloomSplitBlock* make_sized_bloom<BloomSplitBlock>(std::size_t keys){
+    return new BloomSplitBlock(BloomSplitBlock::log_blocks_for(keys));
+}
+
+// Online merge: RW keys move to RO in bounded batches while transactions
+// keep running. Each batch is one transaction that removes its keys from
+// RW and, at install time (with the removed records still locked),
+// inserts them into RO. `bloom` stays a superset of the keys in RW during
+// the merge; keys inserted meanwhile also go into the next generation's
+// filter, which replaces `bloom` once the scan has passed every key that
+// was in RW when the merge began. Each generation's filter is sized for
+// about as many keys as the previous generation received, since the
+// interval between merges is what fills RW; rebuild_bloom() replaces
+// a filter that turned out too small without waiting for a merge.
+struct merge_stats {
+    uint64_t keys;          // keys moved to RO
+    uint64_t batches;
+    uint64_t aborts;        // batch transactions that had to retry
+    double duration_ms;
+};
 
-template <typename T, typename BloomT> class HybridART{
+template <typename T, typename BloomT> class HybridART : TObject {
 protected:
+    // The RO tree is replaced whole by bulkLoadRO() and sequentialMerge();
+    // `gen` tells threads when their cached ThreadInfo is stale. Replaced
+    // trees are freed through Transaction::rcu_delete, so lookups must run
+    // inside transactions.
+    struct ro_tree {
+        ART_OLC::Tree tree;
+        uint64_t gen;
+        ro_tree(Tree::LoadKeyFunction loadKeyFun, uint64_t g)
+            : tree(loadKeyFun), gen(g) {
+        }
+    };
+    struct ro_thread_cache {
+        uint64_t gen;       // 0: none cached
+        typename std::aligned_storage<sizeof(ThreadInfo), alignof(ThreadInfo)>::type ti;
+    } __attribute__((aligned(128)));
+
+    // Current bloom generation, a superset of the keys in RW. Replaced
+    // whole when a merge or rebuild ends and retired through
+    // Transaction::rcu_call, so lookups must run inside transactions.
+    std::atomic<BloomT*> bloom;
+    uint64_t bloom_gen;
+    std::size_t bloom_gen_keys;     // keys the current generation is sized for
+    // bloom inserts per thread, ever; bloom_inserts_base is the sum when
+    // the current generation was created
+    struct bloom_insert_count {
+        uint64_t n;
+    } __attribute__((aligned(128)));
+    bloom_insert_count bloom_inserts[N_THREADS];
+    uint64_t bloom_inserts_base;
+
     TART<T, BloomT> tart_rw;
-    ART_OLC::Tree tree_ro;
-    
-    BloomT bloom;
+    Tree::LoadKeyFunction ro_loadKey;
+    std::atomic<ro_tree*> tree_ro;
+    ro_thread_cache ro_tinfo[N_THREADS];
+
+    // next bloom generation; non-null while a merge or rebuild is running
+    BloomT* bloom_next;
+    std::size_t bloom_next_keys;
+    // bloom writers hold bloom_writers; the generation switch waits for
+    // them to drain while bloom_switching is set
+    std::atomic<int> bloom_writers;
+    std::atomic<bool> bloom_switching;
+
+    // online merge state, owned by the merging thread
+    std::atomic<bool> merging;
+    Key merge_cursor;
+    bool merge_done;
+    std::vector<TID> merge_batch;   // RW records moved by the current batch
+    merge_stats mstats;
+    std::chrono::steady_clock::time_point merge_start_time;
+    std::thread merge_thread;
 
 
 inline bool is_using_bloom(){
@@ -41,14 +121,25 @@ public:
         int BF_false_positives[N_THREADS][2] __attribute__((aligned(128)));
     #endif
     
-    HybridART(Tree::LoadKeyFunction ARTloadKeyFun, Tree::LoadKeyFunction TARTloadKeyFun): tart_rw(TARTloadKeyFun, bloom), tree_ro(ARTloadKeyFun)
+    HybridART(Tree::LoadKeyFunction ARTloadKeyFun, Tree::LoadKeyFunction TARTloadKeyFun, std::size_t bloom_keys = BLOOM_GEN_MIN_KEYS)
+        : bloom(make_sized_bloom<BloomT>(bloom_keys)), bloom_gen(1), bloom_gen_keys(bloom_keys), bloom_inserts_base(0),
+        tart_rw(TARTloadKeyFun, *bloom.load()), ro_loadKey(ARTloadKeyFun),
+        tree_ro(new ro_tree(ARTloadKeyFun, 1)), bloom_next(nullptr), bloom_next_keys(0), bloom_writers(0), bloom_switching(false), merging(false), merge_done(true)
     {
         #if MEASURE_BF_FALSE_POSITIVES
             bzero(BF_false_positives, N_THREADS * 2 * sizeof(int));
         #endif
+        bzero(&mstats, sizeof(mstats));
+        bzero(bloom_inserts, sizeof(bloom_inserts));
+        for(unsigned i = 0; i < N_THREADS; i++)
+            ro_tinfo[i].gen = 0;
     }
 
     ~HybridART(){
+        wait_merge();
+        delete bloom_next;
+        delete bloom.load();
+        delete tree_ro.load();
     }
 
     TART<T, BloomT>& getTART(){
@@ -56,7 +147,7 @@ public:
     }
 
     ART_OLC::Tree& getRO(){
-        return tree_ro;
+        return tree_ro.load()->tree;
     }
 
     #if MEASURE_TREE_SIZE == 1
@@ -67,13 +158,15 @@ public:
 
     // Lookup a key with given key index. Lookup will be performed in both RW and RO, if necessary. The key index is 
     // required to guarantee key uniqueness for the bloom filter validation. We do this instead of performing a hash of the key.
-    lookup_res lookup(const Key& k, uint64_t key_ind, ThreadInfo& t_rw, ThreadInfo& t_ro, unsigned thread_id){
-        (void)thread_id;
+    lookup_res lookup(const Key& k, uint64_t key_ind, ThreadInfo& t_rw, unsigned thread_id){
         INIT_COUNTING
+        ro_tree* ro = tree_ro.load();
+        ThreadInfo& t_ro = ro_thread_info(ro, thread_id);
         if(is_using_bloom()){
             bool contains = false;
             uint64_t hashVal[2];
-            contains = bloom.contains(k.getKey(), k.getKeyLen(), hashVal);
+            BloomT* gen = bloom.load();
+            contains = gen->contains(k.getKey(), k.getKeyLen(), hashVal);
             TID val;
             if(contains){ // bloom contains, lookup in RW
                 START_COUNTING
@@ -90,7 +183,7 @@ public:
                     #endif
                     STOP_COUNTING(latencies_rw_lookup_not_found, thread_id)
                     START_COUNTING
-                    val = tree_ro.lookup(k, t_ro);
+                    val = ro->tree.lookup(k, t_ro);
                     STOP_COUNTING(latencies_rw_lookup_found, thread_id)
                     return std::make_tuple(val, true);
                 }
@@ -101,9 +194,9 @@ public:
                     BF_false_positives[thread_id][0]++;
                 #endif
                 // for now we only use BLOOM_VALIDATE 2, snce BLOOM_VALIDATE 1 is much costlier
-                tart_rw.bloom_v_add_key(key_ind, hashVal);
+                tart_rw.bloom_v_add_key(key_ind, hashVal, gen);
                 START_COUNTING
-                val = tree_ro.lookup(k, t_ro);
+                val = ro->tree.lookup(k, t_ro);
                 STOP_COUNTING(latencies_compacted_lookup, thread_id)
                 return std::make_tuple(val, true);
             }
@@ -118,7 +211,7 @@ public:
             if(val == 0) { // not found in RW, look in compacted
                 STOP_COUNTING(latencies_rw_lookup_not_found, thread_id)
                 START_COUNTING
-                val = tree_ro.lookup(k, t_ro);
+                val = ro->tree.lookup(k, t_ro);
                 STOP_COUNTING(latencies_compacted_lookup, thread_id)
                 return std::make_tuple(val, true);
             }
@@ -143,14 +236,21 @@ public:
         if(!std::get<0>(res)) // it is an update, do not insert to bloom!
             bloom_insert = false;
         if(is_using_bloom()){
-            if(bloom_insert)
-                bloom.insert(k.getKey(), k.getKeyLen());
+            if(bloom_insert){
+                bloom_write_lock();
+                bloom.load()->insert(k.getKey(), k.getKeyLen());
+                if(bloom_next)
+                    bloom_next->insert(k.getKey(), k.getKeyLen());
+                bloom_write_unlock();
+                ++bloom_inserts[thread_id].n;
+            }
         }
         return res;
     }
 
-    void ro_insert(const Key& k, TID tid, ThreadInfo& t){
-        tree_ro.insert(k, tid, t);
+    void ro_insert(const Key& k, TID tid){
+        ro_tree* ro = tree_ro.load();
+        ro->tree.insert(k, tid, ro_thread_info(ro, TThread::id()));
     }
 
     rem_res remove(const Key & k, TID tid, ThreadInfo& t){
@@ -158,39 +258,350 @@ public:
         return res;
     }
     
-    void ro_remove(const Key & k, TID tid, ThreadInfo& t){
-        tree_ro.remove(k, tid, t);
+    void ro_remove(const Key & k, TID tid){
+        ro_tree* ro = tree_ro.load();
+        ro->tree.remove(k, tid, ro_thread_info(ro, TThread::id()));
+    }
+
+    // Replaces the RO tree with one bulk-built from `n` TIDs sorted by
+    // key (see ARTBulkLoader::build). The new tree is built without locks
+    // while the old one keeps serving lookups, then swapped in. Returns
+    // false if the keys are unsorted or not prefix-free, or if a merge is
+    // running.
+    bool bulkLoadRO(const TID* tids, std::size_t n){
+        bool expected = false;
+        if(!merging.compare_exchange_strong(expected, true))
+            return false;
+        bool ok = bulk_load_ro(tids, n);
+        merging.store(false);
+        return ok;
+    }
+
+    // Moves every RW key to RO without stopping other threads. Runs in
+    // the calling thread, which must have its own TThread id.
+    merge_stats merge(std::size_t batch_size = 1024){
+        if(!merge_begin())
+            return mstats;
+        while(merge_step(batch_size))
+            /* do nothing */;
+        merge_end();
+        return mstats;
+    }
+
+    // Runs merge() on a new thread that uses TThread id `thread_id`.
+    // Returns false if a merge is already running.
+    bool start_background_merge(unsigned thread_id, std::size_t batch_size = 1024, unsigned pause_us = 0){
+        if(merging.load())
+            return false;
+        wait_merge();
+        if(!merge_begin())
+            return false;
+        merge_thread = std::thread([this, thread_id, batch_size, pause_us] {
+            TThread::set_id(thread_id);
+            Sto::update_threadid();
+            while(merge_step(batch_size)){
+                if(pause_us)
+                    usleep(pause_us);
+            }
+            merge_end();
+        });
+        return true;
+    }
+
+    void wait_merge(){
+        if(merge_thread.joinable())
+            merge_thread.join();
+    }
+
+    bool is_merging() const {
+        return merging.load();
+    }
+
+    // statistics of the running or most recent merge
+    const merge_stats& last_merge_stats() const {
+        return mstats;
+    }
+
+    // Starts a merge: inserts from now on also enter the next bloom
+    // generation. Returns false if a merge is already running.
+    bool merge_begin(){
+        bool expected = false;
+        if(!merging.compare_exchange_strong(expected, true))
+            return false;
+        bzero(&mstats, sizeof(mstats));
+        merge_start_time = std::chrono::steady_clock::now();
+        char key_dat[1] = {(char)0};
+        merge_cursor.set(key_dat, (unsigned)1);
+        merge_done = false;
+        if(is_using_bloom()){
+            // the next generation gets about as many keys as this one did
+            uint64_t gen_inserts = bloom_inserts_total() - bloom_inserts_base;
+            bloom_begin_generation(std::max<std::size_t>(gen_inserts, BLOOM_GEN_MIN_KEYS));
+        }
+        return true;
+    }
+
+    // Moves up to `batch_size` keys, at or after the merge cursor, from RW
+    // to RO in one transaction. Returns false once the scan is complete.
+    bool merge_step(std::size_t batch_size){
+        if(merge_done)
+            return false;
+        ThreadInfo t_rw = tart_rw.getThreadInfo();
+        TID* results = new TID[batch_size];
+        std::size_t resultsFound = 0;
+        Key key_end, key_cont;
+        char key_dat[1] = {(char)255};
+        key_end.set(key_dat, (unsigned)1);
+        bool more = tart_rw.lookupRange(merge_cursor, key_end, key_cont, results, batch_size, resultsFound, t_rw);
+        uint64_t attempts = 0;
+        TRANSACTION {
+            ++attempts;
+            merge_batch.clear();
+            for(std::size_t i = 0; i < resultsFound; i++){
+                Key k;
+                tart_rw.loadKey(results[i], k);
+                lookup_res l_res = tart_rw.t_lookup(k, t_rw);
+                TXN_DO(std::get<1>(l_res))
+                if(std::get<0>(l_res) == 0) // removed since the scan
+                    continue;
+                rem_res r_res = tart_rw.t_remove(k, std::get<0>(l_res), t_rw);
+                TXN_DO(std::get<1>(r_res))
+                merge_batch.push_back(results[i]);
+            }
+            if(!merge_batch.empty())
+                Sto::item(this, 0).add_write();
+        } RETRY(true);
+        mstats.aborts += attempts - 1;
+        mstats.keys += merge_batch.size();
+        ++mstats.batches;
+        delete[] results;
+        if(more)
+            merge_cursor.set((const char*)&key_cont[0], key_cont.getKeyLen());
+        else
+            merge_done = true;
+        return more;
     }
 
-    //
-    void merge(){
-        sequentialMerge();
+    // Finishes a merge: every key that was in RW when it began is now in
+    // RO, so the next bloom generation replaces the current one.
+    void merge_end(){
+        if(bloom_next)
+            bloom_end_generation();
+        mstats.duration_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - merge_start_time).count();
+        merging.store(false);
     }
    
-    // this will be called by the main thread when 
-    // making sure that all other threads block and wait
-    // for the merge to finish
+
+    // Replaces the bloom filter with one sized for `expected_keys` and
+    // filled from the keys now in RW, e.g. when the current generation
+    // received more keys than it was sized for. Inserts keep running.
+    // Returns false if a merge is running.
+    bool rebuild_bloom(std::size_t expected_keys){
+        if(!is_using_bloom())
+            return false;
+        bool expected = false;
+        if(!merging.compare_exchange_strong(expected, true))
+            return false;
+        bloom_begin_generation(expected_keys);
+        // keys inserted from now on also enter bloom_next by themselves
+        std::vector<TID> recs;
+        ThreadInfo t_rw = tart_rw.getThreadInfo();
+        scan_all(tart_rw, t_rw, recs);
+        for(TID rec : recs){
+            Key k;
+            tart_rw.loadKey(rec, k);
+            bloom_next->insert(k.getKey(), k.getKeyLen());
+        }
+        bloom_end_generation();
+        merging.store(false);
+        return true;
+    }
+
+    // current bloom generation (1 at creation), and the keys it was sized for
+    uint64_t bloom_generation(std::size_t* sized_keys = nullptr) const {
+        if(sized_keys)
+            *sized_keys = bloom_gen_keys;
+        return bloom_gen;
+    }
+
+    // Stop-the-world merge, kept for comparison with merge(): this will be
+    // called by the main thread when making sure that all other threads
+    // block and wait for the merge to finish. RW keys are copied into a
+    // new RO tree, bulk-built from the sorted union of RO and RW.
     void sequentialMerge(){
-        Key key_start, key_end, key_cont;
-        TID *results;
+        bool expected = false;
+        if(!merging.compare_exchange_strong(expected, true))
+            return;
+        ro_tree* ro = tree_ro.load();
+        std::vector<TID> ro_tids, rw_recs;
+        scan_all(ro->tree, ro_thread_info(ro, TThread::id()), ro_tids);
         ThreadInfo t_rw = tart_rw.getThreadInfo();
-        ThreadInfo t_ro = tree_ro.getThreadInfo();
-        results = new TID[MAX_KEYS];
-        std::size_t resultsFound;
+        scan_all(tart_rw, t_rw, rw_recs);
+        cout<<"Found "<<rw_recs.size()<<" keys in RW\n";
+
+        // merge the two sorted streams; RW wins on equal keys
+        std::vector<TID> merged;
+        merged.reserve(ro_tids.size() + rw_recs.size());
+        std::size_t i = 0, j = 0;
+        while(i < ro_tids.size() || j < rw_recs.size()){
+            int cmp;
+            if(i == ro_tids.size())
+                cmp = 1;
+            else if(j == rw_recs.size())
+                cmp = -1;
+            else {
+                Key ko, kw;
+                ro_loadKey(ro_tids[i], ko);
+                tart_rw.loadKey(rw_recs[j], kw);
+                cmp = compare_keys(ko, kw);
+            }
+            if(cmp < 0)
+                merged.push_back(ro_tids[i++]);
+            else {
+                if(cmp == 0)
+                    i++;
+                merged.push_back(reinterpret_cast<typename TART<T, BloomT>::record*>(rw_recs[j++])->val);
+            }
+        }
+        bulk_load_ro(merged.data(), merged.size());
+        merging.store(false);
+    }
+
+private:
+    // STO callbacks for the merge batch item: RO inserts happen at
+    // install time, while the batch's RW records are locked.
+    bool lock(TransItem&, Transaction&){
+        return true;
+    }
+    bool check(TransItem&, Transaction&){
+        return true;
+    }
+    void install(TransItem&, Transaction&){
+        ro_tree* ro = tree_ro.load();
+        ThreadInfo& t_ro = ro_thread_info(ro, TThread::id());
+        for(TID rec_tid : merge_batch){
+            Key k;
+            tart_rw.loadKey(rec_tid, k);
+            auto rec = reinterpret_cast<typename TART<T, BloomT>::record*>(rec_tid);
+            ro->tree.insert(k, rec->val, t_ro);
+        }
+    }
+    void unlock(TransItem&){
+    }
+
+    ThreadInfo& ro_thread_info(ro_tree* ro, unsigned thread_id){
+        ro_thread_cache& c = ro_tinfo[thread_id];
+        if(c.gen != ro->gen){
+            // the cached ThreadInfo refers to a replaced tree's epoche,
+            // which may be gone; overwrite it without destroying it
+            new (&c.ti) ThreadInfo(ro->tree.getThreadInfo());
+            c.gen = ro->gen;
+        }
+        return *reinterpret_cast<ThreadInfo*>(&c.ti);
+    }
+
+    bool bulk_load_ro(const TID* tids, std::size_t n){
+        ro_tree* old = tree_ro.load();
+        ro_tree* ro = new ro_tree(ro_loadKey, old->gen + 1);
+        if(!ARTBulkLoader::build(ro->tree, tids, n, ro_loadKey)){
+            delete ro;
+            return false;
+        }
+        tree_ro.store(ro);
+        Transaction::rcu_delete(old);
+        return true;
+    }
+
+    static int compare_keys(const Key& a, const Key& b){
+        uint32_t la = a.getKeyLen(), lb = b.getKeyLen();
+        int cmp = memcmp(&a[0], &b[0], std::min(la, lb));
+        if(cmp == 0)
+            cmp = la < lb ? -1 : (la > lb ? 1 : 0);
+        return cmp;
+    }
+
+    // appends every TID in `tree`, in key order
+    template <typename TreeT>
+    static void scan_all(TreeT& tree, ThreadInfo& t, std::vector<TID>& out){
+        static constexpr std::size_t chunk = 1 << 16;
+        Key key_start, key_end, key_cont;
         char key_dat [][2] = {{(char)0}, {(char)255}};
         key_start.set(key_dat[0], (unsigned)1);
         key_end.set(key_dat[1], (unsigned)1);
-        tart_rw.lookupRange(key_start, key_end, key_cont, results, MAX_KEYS, resultsFound, t_rw);
-        cout<<"Found "<<resultsFound<<" keys in RW\n";
-        for(std::size_t i=0; i<resultsFound; i++){
-            Key k;
-            tart_rw.loadKey(results[i], k);
-            typename TART<T, BloomT>::record* rec = reinterpret_cast<typename TART<T, BloomT>::record*>(results[i]);
-            tree_ro.insert(k, rec->val, t_ro);
+        while(true){
+            std::size_t base = out.size(), found = 0;
+            out.resize(base + chunk);
+            bool more = tree.lookupRange(key_start, key_end, key_cont, &out[base], chunk, found, t);
+            out.resize(base + found);
+            if(!more)
+                break;
+            key_start.set((const char*)&key_cont[0], key_cont.getKeyLen());
         }
-        delete [] results;
     }
 
+    uint64_t bloom_inserts_total() const {
+        uint64_t n = 0;
+        for(unsigned i = 0; i < N_THREADS; i++)
+            n += bloom_inserts[i].n;
+        return n;
+    }
+
+    static void destroy_bloom(void* p){
+        delete static_cast<BloomT*>(p);
+    }
+
+    // Creates the next bloom generation; inserts from now on enter both.
+    void bloom_begin_generation(std::size_t keys){
+        BloomT* next = make_sized_bloom<BloomT>(keys);
+        bloom_switch_lock();
+        bloom_next = next;
+        bloom_next_keys = keys;
+        bloom_inserts_base = bloom_inserts_total();
+        bloom_switch_unlock();
+    }
+
+    // Makes the next generation current, once it holds every key in RW.
+    // Lookups still using the old filter may hold it until RCU frees it;
+    // transactions that missed in it fail bloom validation.
+    void bloom_end_generation(){
+        bloom_switch_lock();
+        BloomT* old = bloom.load();
+        bloom.store(bloom_next);
+        tart_rw.set_bloom(*bloom_next);
+        bloom_next = nullptr;
+        bloom_gen_keys = bloom_next_keys;
+        ++bloom_gen;
+        bloom_switch_unlock();
+        Transaction::rcu_call(destroy_bloom, old);
+    }
+
+    // Bloom inserts run concurrently with each other; a generation
+    // switch excludes them. Lookups only read the current generation,
+    // which is a superset of RW throughout. A miss validates only against
+    // the generation it was made in, so a switch aborts transactions that
+    // missed in the old one.
+    void bloom_write_lock(){
+        while(true){
+            bloom_writers.fetch_add(1);
+            if(!bloom_switching.load())
+                return;
+            bloom_writers.fetch_sub(1);
+            while(bloom_switching.load())
+                relax_fence();
+        }
+    }
+    void bloom_write_unlock(){
+        bloom_writers.fetch_sub(1);
+    }
+    void bloom_switch_lock(){
+        bloom_switching.store(true);
+        while(bloom_writers.load() != 0)
+            relax_fence();
+    }
+    void bloom_switch_unlock(){
+        bloom_switching.store(false);
+    }
 };
 
 
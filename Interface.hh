@@ -15,16 +15,21 @@ class TransProxy;
 
 class TThread {
     static __thread int the_id;
+    static __thread int the_lock_id;
 public:
     static __thread Transaction* txn;
 
     static int id() {
         return the_id;
     }
-    static void set_id(int id) {
-        assert(id >= 0 && id < 32);
-        the_id = id;
+    // The thread id whose locks count as held "here": id(), except in a
+    // commit-validation helper, which checks reads on behalf of the
+    // committing thread but keeps its own id for per-thread state.
+    static int lock_id() {
+        return the_lock_id;
     }
+    static inline void set_id(int id);
+    static inline void set_lock_id(int id);
 };
 
 class TransactionTid {
@@ -32,14 +37,19 @@ public:
     typedef uint64_t type;
     typedef int64_t signed_type;
 
-    static constexpr type threadid_mask = type(0x1F);
-    static constexpr type lock_bit = type(0x20);
+    // The owner's thread id lives in the low byte of a locked version, so
+    // up to max_threads STO threads can hold locks concurrently.
+    static constexpr type threadid_mask = type(0xFF);
+    static constexpr type lock_bit = type(0x100);
     // Used for data structures that don't use opacity. When they increment
     // a version they set the nonopaque_bit, forcing any opacity check to be
     // hard (checking the full read set).
-    static constexpr type nonopaque_bit = type(0x40);
-    static constexpr type user_bit = type(0x80);
-    static constexpr type increment_value = type(0x400);
+    static constexpr type nonopaque_bit = type(0x200);
+    // Three user bits (user_bit, user_bit<<1, user_bit<<2) sit below
+    // increment_value.
+    static constexpr type user_bit = type(0x400);
+    static constexpr type increment_value = type(0x2000);
+    static constexpr int max_threads = int(threadid_mask) + 1;
 
     // TODO: probably remove these once RBTree stops referencing them.
     static void lock_read(type& v) {
@@ -82,14 +92,14 @@ public:
         return v & lock_bit;
     }
     static bool is_locked_here(type v) {
-        return (v & (lock_bit | threadid_mask)) == (lock_bit | TThread::id());
+        return (v & (lock_bit | threadid_mask)) == (lock_bit | TThread::lock_id());
     }
     static bool is_locked_here(type v, int here) {
         return (v & (lock_bit | threadid_mask)) == (lock_bit | here);
     }
     static bool is_locked_elsewhere(type v) {
         type m = v & (lock_bit | threadid_mask);
-        return m != 0 && m != (lock_bit | TThread::id());
+        return m != 0 && m != (lock_bit | TThread::lock_id());
     }
     static bool is_locked_elsewhere(type v, int here) {
         type m = v & (lock_bit | threadid_mask);
@@ -193,7 +203,7 @@ public:
     static bool check_version(type cur_vers, type old_vers) {
         assert(!is_locked_elsewhere(old_vers));
         // cur_vers allowed to be locked by us
-        return cur_vers == old_vers || cur_vers == (old_vers | lock_bit | TThread::id());
+        return cur_vers == old_vers || cur_vers == (old_vers | lock_bit | TThread::lock_id());
     }
     static bool check_version(type cur_vers, type old_vers, int here) {
         assert(!is_locked_elsewhere(old_vers));
@@ -219,6 +229,16 @@ public:
     }
 };
 
+inline void TThread::set_id(int id) {
+    assert(id >= 0 && id < TransactionTid::max_threads);
+    the_id = the_lock_id = id;
+}
+
+inline void TThread::set_lock_id(int id) {
+    assert(id >= 0 && id < TransactionTid::max_threads);
+    the_lock_id = id;
+}
+
 class TVersion {
 public:
     typedef TransactionTid::type type;
@@ -462,9 +482,14 @@ class TCommutativeVersion {
 public:
     typedef TransactionTid::type type;
     typedef TransactionTid::signed_type signed_type;
-    // we don't store thread ids and instead use those bits as a count of
-    // how many threads own the lock (aka a read lock)
-    static constexpr type lock_mask = TransactionTid::threadid_mask;
+    // we don't store thread ids and instead use those bits, plus the lock
+    // bit right above them, as a count of how many threads own the lock
+    // (aka a read lock), so every STO thread can hold it at once
+    static constexpr type lock_mask = TransactionTid::threadid_mask | TransactionTid::lock_bit;
+    static_assert(TransactionTid::lock_bit == TransactionTid::threadid_mask + 1,
+                  "TCommutativeVersion's holder count must be contiguous");
+    static_assert(lock_mask >= type(TransactionTid::max_threads),
+                  "TCommutativeVersion's holder count must fit every thread");
     static constexpr type user_bit = TransactionTid::user_bit;
     static constexpr type nonopaque_bit = TransactionTid::nonopaque_bit;
 
@@ -495,10 +520,14 @@ public:
         return true;
     }
     void lock() {
-        __sync_fetch_and_add(&v_, 1);
+        type old = __sync_fetch_and_add(&v_, 1);
+        assert((old & lock_mask) != lock_mask);
+        (void) old;
     }
     void unlock() {
-        __sync_fetch_and_add(&v_, -1);
+        type old = __sync_fetch_and_add(&v_, -1);
+        assert((old & lock_mask) != 0);
+        (void) old;
     }
 
     type unlocked() const {
@@ -580,6 +609,9 @@ public:
         (void) item, (void) committed;
     }
     virtual void print(std::ostream& w, const TransItem& item) const;
+    // Key bucket that aborts on `item` are charged to in the abort
+    // attribution report. Defaults to the item's raw key.
+    virtual uint64_t abort_bucket(const TransItem& item) const;
 };
 
 typedef TObject Shared;
@@ -15,9 +15,21 @@
 #include "StringWrapper.hh"
 #include "versioned_value.hh"
 #include "stuffed_str.hh"
+#include "ValueArena.hh"
+#include <thread>
+#include <vector>
 
 #define RCU 1
 #define ABORT_ON_WRITE_READ_CONFLICT 0
+// Range query phantom checks. A query either reads the versions of the
+// leaves it visited, so any insert into them aborts it, or has its
+// interval scanned again at commit (see scan_range). A rescan catches
+// phantoms only at commit, which gives up opacity for range queries.
+// 0: leaf versions. 1: rescan for MassTrans without Opacity, leaf
+// versions for the rest. 2: rescan everywhere.
+#ifndef MASSTRANS_RANGE_VALIDATION
+#define MASSTRANS_RANGE_VALIDATION 1
+#endif
 
 #ifndef READ_MY_WRITES
 #define READ_MY_WRITES 1
@@ -38,13 +50,21 @@ struct versioned_str_struct : public versioned_str {
     return needs_resize(v.length());
   }
 
+  // Values live in the value_arena. Its size classes leave some slack
+  // past the string, so an update that still fits is written in place.
+  template <typename StringType>
+  static versioned_str_struct* make(const StringType& s, version_type v) {
+    // TODO: this cast is only safe because we have no ivars or virtual methods
+    return (versioned_str_struct*)versioned_str::make(s.data(), s.length(), versioned_str::size_for(s.length()), v, value_arena::allocator());
+  }
+
   versioned_str_struct* resizeIfNeeded(const value_type& potential_new_value) {
     // TODO: this cast is only safe because we have no ivars or virtual methods
-    return (versioned_str_struct*)this->reserve(versioned_str::size_for(potential_new_value.length()));
+    return (versioned_str_struct*)this->reserve(versioned_str::size_for(potential_new_value.length()), value_arena::allocator());
   }
   versioned_str_struct* resizeIfNeeded(const std::string& potential_new_value) {
     // TODO: this cast is only safe because we have no ivars or virtual methods
-    return (versioned_str_struct*)this->reserve(versioned_str::size_for(potential_new_value.length()));
+    return (versioned_str_struct*)this->reserve(versioned_str::size_for(potential_new_value.length()), value_arena::allocator());
   }
 
   template <typename StringType>
@@ -64,10 +84,21 @@ struct versioned_str_struct : public versioned_str {
     return stuff();
   }
 
-  inline void deallocate_rcu(threadinfo& ti) {
-    ti.deallocate_rcu(this, this->capacity() + sizeof(versioned_str_struct), memtag_value);
+  // back to the arena once no transaction can still be reading us
+  inline void deallocate_rcu(threadinfo&) {
+    Transaction::rcu_call(arena_free, this, alloc_size());
+  }
+
+private:
+  size_t alloc_size() {
+    return this->capacity() + sizeof(versioned_str_struct);
+  }
+  static void arena_free(void* p) {
+    auto* v = static_cast<versioned_str_struct*>(p);
+    value_arena::free(v, v->alloc_size());
   }
 
+public:
   // Masstree debug printer
   void print(FILE* f, const char* prefix,
     int indent, Masstree::Str key, kvtimestamp_t, char* suffix) {
@@ -93,6 +124,9 @@ public:
 
   typedef typename Box::version_type Version;
   typedef typename std::conditional<Opacity, TVersion, TNonopaqueVersion>::type tversion_type;
+  // whether range queries are validated by rescanning their interval
+  static constexpr bool range_rescan = MASSTRANS_RANGE_VALIDATION == 2
+      || (MASSTRANS_RANGE_VALIDATION == 1 && !Opacity);
 
   static __thread threadinfo_type mythreadinfo;
 
@@ -101,8 +135,14 @@ protected:
   typedef Box versioned_value;
   
 public:
+    // TODO: writes are still buffered as V (std::string for string
+    // values); buffering them in value_arena memory is not done yet.
     typedef V write_value_type;
     typedef std::string key_write_value_type;
+    // What range queries hand their callbacks. For versioned_str_struct
+    // values in a non-opaque table this is a Str view of the value in the
+    // tree, not a copy (see transGet); opaque tables hand out copies.
+    typedef typename std::conditional<Opacity, V, typename Box::value_type>::type read_value_type;
 
   MassTrans() {
 #if RCU
@@ -166,17 +206,62 @@ public:
     bool found = lp.find_insert(*ti.ti);
     if (found) {
       versioned_value *e = lp.value();
-      e->writeable_value() = value;
+      if (e->needsResize(value)) {
+        lp.value() = e->resizeIfNeeded(value);
+        e->deallocate_rcu(*ti.ti);
+        e = lp.value();
+      }
+      e->set_value(value);
     } else {
       versioned_value *val = (versioned_value *)versioned_value::make(value, Sto::initialized_tid());
       lp.value() = val;
-      lp.finish(1, *ti.ti);
     }
+    lp.finish(found ? 0 : 1, *ti.ti);
     return found;
   }
 
+  // Loads n key/value pairs, gen(i) returning the i'th pair (the key as
+  // anything a Str can view, e.g. a std::string), using nthreads threads.
+  // For populating a tree before a run: no transaction may use the tree
+  // meanwhile, and new values get version Sto::initialized_tid(). Each
+  // thread loads a contiguous slice of the input, so with sorted input the
+  // threads mostly fill disjoint leaves. The loaders run as the thread ids
+  // just below the validation helpers' (Transaction::validation_config),
+  // so no other thread may use those ids during the load.
+  template <typename F>
+  void bulk_load(size_t n, unsigned nthreads, F gen) {
+    nthreads = std::max(nthreads, 1U);
+    int first_id = Transaction::validation_config.first_threadid - int(nthreads);
+    always_assert(first_id >= 0);
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < nthreads; ++p)
+      threads.emplace_back([&, p] () {
+        TThread::set_id(first_id + p);
+        thread_init();
+        for (size_t i = n * p / nthreads; i < n * (p + 1) / nthreads; ++i) {
+          auto kv = gen(i);
+          nontransPut(Str(kv.first), kv.second);
+        }
+      });
+    for (auto& th : threads)
+      th.join();
+  }
+
+  // With versioned_str_struct values in a non-opaque table, retval may
+  // be a Str: it then views the value in the tree instead of copying it.
+  // The memory stays valid until the transaction ends (values are freed
+  // through RCU), but its contents do not: a concurrent commit that fits
+  // the value's size class rewrites it in place, even while the caller is
+  // reading. Such a transaction fails its version check at commit, but
+  // until then, and after the transaction ends, the view may show
+  // anything. That is no weaker than what a non-opaque read promises, but
+  // it would break opacity, so opaque tables only return copies. A value
+  // the transaction wrote itself is copied into a buffer that lasts until
+  // the transaction ends, since its next write to the key would change it.
   template <typename ValType>
   bool transGet(Str key, ValType& retval, threadinfo_type& ti = mythreadinfo) {
+    static_assert(!Opacity || !std::is_same<ValType, Str>::value,
+                  "Str views of values need a non-opaque MassTrans");
     unlocked_cursor_type lp(table_, key);
     bool found = lp.find_unlocked(*ti.ti);
     if (found) {
@@ -196,9 +281,9 @@ public:
       if (item.has_write()) {
         // read directly from the element if we're inserting it
         if (has_insert(item)) {
-	  assign_val(retval, e->read_value());
+	  assign_own_val(retval, e->read_value());
         } else {
-	    retval = item.template write_value<write_value_type>();
+	    assign_own_val(retval, item.template write_value<write_value_type>());
         }
         return true;
       }
@@ -356,21 +441,25 @@ public:
   // unused (we just stack alloc if no allocator is passed)
   class DefaultValAllocator {
   public:
-    value_type* operator()() {
+    read_value_type* operator()() {
       assert(0);
-      return new value_type();
+      return new read_value_type();
     }
   };
 
   // range queries
   template <typename Callback, typename ValAllocator = DefaultValAllocator>
   void transQuery(Str begin, Str end, Callback callback, ValAllocator *va = NULL, threadinfo_type& ti = mythreadinfo) {
+    scan_range* range = range_rescan ? add_range(begin, end, false) : nullptr;
     auto node_callback = [&] (leaf_type* node, typename unlocked_cursor_type::nodeversion_value_type version) {
-      this->ensureNotFound(node, version);
+      if (!range_rescan)
+        this->ensureNotFound(node, version);
     };
-    auto value_callback = [&] (Str key, versioned_value* e) {
+    auto visit = [&] (Str key, versioned_value* e) {
       // TODO: this needs to read my writes
       auto item = this->t_read_only_item(e);
+      if (range_rescan && !has_insert(item))
+        range->add(e);
 #if READ_MY_WRITES
       if (has_delete(item)) {
         return true;
@@ -386,8 +475,8 @@ public:
       }
 #endif
       // not sure of a better way to do this
-      value_type stack_val;
-      value_type& val = va ? *(*va)() : stack_val;
+      read_value_type stack_val;
+      read_value_type& val = va ? *(*va)() : stack_val;
       Version v;
       atomicRead(e, v, val);
       item.observe(tversion_type(v));
@@ -399,6 +488,12 @@ public:
       // key and val are both only guaranteed until callback returns
       return callback(key, val);//query_callback_overload(key, val, callback);
     };
+    auto value_callback = [&] (Str key, versioned_value* e) {
+      bool more = visit(key, e);
+      if (range_rescan && !more)
+        range->stop_at(key);
+      return more;
+    };
 
     range_scanner<decltype(node_callback), decltype(value_callback)> scanner(end, node_callback, value_callback);
     table_.scan(begin, true, scanner, *ti.ti);
@@ -406,14 +501,18 @@ public:
 
   template <typename Callback, typename ValAllocator = DefaultValAllocator>
   void transRQuery(Str begin, Str end, Callback callback, ValAllocator *va = NULL, threadinfo_type& ti = mythreadinfo) {
+    scan_range* range = range_rescan ? add_range(begin, end, true) : nullptr;
     auto node_callback = [&] (leaf_type* node, typename unlocked_cursor_type::nodeversion_value_type version) {
-      this->ensureNotFound(node, version);
+      if (!range_rescan)
+        this->ensureNotFound(node, version);
     };
-    auto value_callback = [&] (Str key, versioned_value* e) {
+    auto visit = [&] (Str key, versioned_value* e) {
       auto item = this->t_read_only_item(e);
+      if (range_rescan && !has_insert(item))
+        range->add(e);
       // not sure of a better way to do this
-      value_type stack_val;
-      value_type& val = va ? *(*va)() : stack_val;
+      read_value_type stack_val;
+      read_value_type& val = va ? *(*va)() : stack_val;
 #if READ_MY_WRITES
       if (has_delete(item)) {
         return true;
@@ -436,6 +535,12 @@ public:
 
       return callback(key, val);
     };
+    auto value_callback = [&] (Str key, versioned_value* e) {
+      bool more = visit(key, e);
+      if (range_rescan && !more)
+        range->stop_at(key);
+      return more;
+    };
 
     range_scanner<decltype(node_callback), decltype(value_callback), true> scanner(end, node_callback, value_callback);
     table_.rscan(begin, true, scanner, *ti.ti);
@@ -445,14 +550,97 @@ public:
   template <typename Callback, typename ValAllocator>
   // for some reason inlining this/not making it a function gives a 5% slowdown on g++...
   static __attribute__((noinline)) bool range_query_has_insert(Callback callback, Str key, versioned_value *e, ValAllocator *va) {
-    value_type stack_val;
-    value_type& val = va ? *(*va)() : stack_val;
+    read_value_type stack_val;
+    read_value_type& val = va ? *(*va)() : stack_val;
     assign_val(val, e->read_value());
     return callback(key, val);
   }
 #endif
 
 protected:
+  // A range query's phantom check when range_rescan is set. The query
+  // records the interval it covered, from `begin` up to `bound`
+  // (down to it for reverse queries), and a count and fingerprint of the
+  // values it found there. At commit the interval is scanned again and
+  // must hold the same values: only an insert or delete inside the
+  // interval aborts the query, not any change to the leaves it spans.
+  // Values this transaction inserted are left out of both scans.
+  struct scan_range {
+    std::string begin;
+    std::string bound;
+    bool reverse;
+    bool bound_inclusive; // the query stopped early, at `bound`
+    uint64_t count;
+    uint64_t fp;
+
+    void add(versioned_value* e) {
+      ++count;
+      fp ^= reinterpret_cast<uintptr_t>(e);
+    }
+    void stop_at(Str key) {
+      bound.assign(key.data(), key.length());
+      bound_inclusive = true;
+    }
+    // true if the scan should go on to key; false once key is past bound
+    bool covers(Str key) const {
+      if (bound.empty() && !bound_inclusive)
+        return true;
+      Str b(bound);
+      if (key == b)
+        return bound_inclusive;
+      return reverse ? b < key : key < b;
+    }
+  };
+
+  scan_range* add_range(Str begin, Str end, bool reverse) {
+    scan_range* r = new scan_range;
+    r->begin.assign(begin.data(), begin.length());
+    r->bound.assign(end.data(), end.length());
+    r->reverse = reverse;
+    r->bound_inclusive = false;
+    r->count = r->fp = 0;
+    // lives until this transaction is over, committed or not
+    Transaction::rcu_delete(r);
+    Sto::new_item(this, tag_range(r)).add_read(0);
+    return r;
+  }
+
+  // the calling thread's threadinfo. Validation helper threads, which
+  // check on behalf of other threads, get one on first use.
+  static threadinfo& local_threadinfo() {
+    if (!mythreadinfo.ti) {
+#if RCU
+      mythreadinfo.ti = threadinfo::make(threadinfo::TI_PROCESS, TThread::id());
+#else
+      mythreadinfo.ti = new threadinfo;
+#endif
+    }
+    return *mythreadinfo.ti;
+  }
+
+  bool range_check(const scan_range* r, Transaction& txn) {
+    uint64_t count = 0, fp = 0;
+    auto node_callback = [] (leaf_type*, typename unlocked_cursor_type::nodeversion_value_type) {};
+    auto value_callback = [&] (Str key, versioned_value* e) {
+      if (!r->covers(key))
+        return false;
+      auto item = txn.check_item(this, e);
+      if (!item || !has_insert(*item)) {
+        ++count;
+        fp ^= reinterpret_cast<uintptr_t>(e);
+      }
+      return !r->bound_inclusive || !(key == Str(r->bound));
+    };
+    if (r->reverse) {
+      range_scanner<decltype(node_callback), decltype(value_callback), true> scanner(Str(), node_callback, value_callback);
+      table_.rscan(Str(r->begin), true, scanner, local_threadinfo());
+    } else {
+      range_scanner<decltype(node_callback), decltype(value_callback)> scanner(Str(), node_callback, value_callback);
+      table_.scan(Str(r->begin), true, scanner, local_threadinfo());
+    }
+    return count == r->count && fp == r->fp;
+  }
+
   // range query class thang
   template <typename Nodecallback, typename Valuecallback, bool Reverse = false>
   class range_scanner {
@@ -532,7 +720,9 @@ public:
         versioned_value* vv = item.key<versioned_value*>();
         return txn.try_lock(item, vv->version());
     }
-  bool check(TransItem& item, Transaction&) override {
+  bool check(TransItem& item, Transaction& txn) override {
+    if (is_range(item))
+      return range_check(untag_range(item.key<scan_range*>()), txn);
     if (is_inter(item)) {
       auto n = untag_inter(item.key<leaf_type*>());
       auto cur_version = n->full_version_value();
@@ -750,6 +940,7 @@ protected:
   static constexpr Version invalid_bit = TransactionTid::user_bit;
 
   static constexpr uintptr_t internode_bit = 1<<0;
+  static constexpr uintptr_t range_bit = 1<<1;
 
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
@@ -769,6 +960,15 @@ protected:
   static bool is_inter(const TransItem& t) {
       return is_inter(t.key<versioned_value*>());
   }
+  static scan_range* tag_range(scan_range* r) {
+    return (scan_range*)((uintptr_t)r | range_bit);
+  }
+  static scan_range* untag_range(scan_range* r) {
+    return (scan_range*)((uintptr_t)r & ~range_bit);
+  }
+  static bool is_range(const TransItem& t) {
+    return t.key<uintptr_t>() & range_bit;
+  }
 
   static void check_opacity(Version& v) {
     Version v2 = v;
@@ -801,7 +1001,8 @@ protected:
 #endif
   }
 
-  static void atomicRead(versioned_value *e, Version& vers, value_type& val) {
+  template <typename ValType>
+  static void atomicRead(versioned_value *e, Version& vers, ValType& val) {
     Version v2;
     do {
       v2 = e->version();
@@ -824,6 +1025,25 @@ protected:
     val.assign(val_to_assign.data(), val_to_assign.length());
   }
 
+  // read-my-writes values, for transGet. A Str must not view the write
+  // buffer or our inserted element: both change at our next write.
+  template <typename ValType, typename Src>
+  static void assign_own_val(ValType& val, const Src& src) {
+    val = src;
+  }
+  static void assign_own_val(std::string& val, Str src) {
+    assign_val(val, src);
+  }
+  static void assign_own_val(Str& val, Str src) {
+    std::string* copy = new std::string(src.data(), src.length());
+    // lives until this transaction is over, committed or not
+    Transaction::rcu_delete(copy);
+    val = Str(*copy);
+  }
+  static void assign_own_val(Str& val, const std::string& src) {
+    assign_own_val(val, Str(src));
+  }
+
   struct table_params : public Masstree::nodeparams<15,15> {
     typedef versioned_value* value_type;
     typedef Masstree::value_print<value_type> value_print_type;
@@ -0,0 +1,690 @@
+#pragma once
+#include "config.h"
+#include "compiler.hh"
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Interface.hh"
+#include "Transaction.hh"
+#include "TWrapped.hh"
+#include "local_vector.hh"
+#include "print_value.hh"
+
+#ifndef READ_MY_WRITES
+#define READ_MY_WRITES 1
+#endif
+
+/*
+ *    Open-addressing transactional hash table
+ *    ----------------------------------------
+ *    An alternative to Hashtable with no per-element allocation. The
+ *    table is an array of cache-line buckets; each bucket holds a version,
+ *    one tag byte per slot, and the slots themselves (element version, key
+ *    and value, with small values stored inline by TWrapped). A lookup
+ *    matches a key's tag against all of a bucket's tags at once (SSE2),
+ *    compares keys only on tag hits, and probes the following buckets
+ *    until it finds the key or a bucket that no key was displaced past
+ *    (each bucket counts the keys stored beyond it). Deleted slots become
+ *    tombstones that later inserts reuse; they never lengthen a probe.
+ *
+ *    The TObject protocol is Hashtable's: elements are locked, checked
+ *    and installed through their versions, inserts claim an invalid slot
+ *    during execution, and deletes become tombstones at cleanup. Absent
+ *    keys are validated with the versions of every bucket the lookup
+ *    probed, which are bumped whenever a key is added to them.
+ *
+ *    Keys and values must be trivially copyable: lookups copy a slot's
+ *    key and value without locking, while an insert may be constructing
+ *    or a remove destroying them. The table does not grow: size it for
+ *    the keys it will hold (`capacity`); it aborts the program if full.
+ */
+
+template <typename K, typename V, bool Opacity = true, unsigned Init_size = 129, typename W = V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
+class OpenHashtable : public TObject {
+public:
+    typedef K Key;
+    typedef K key_type;
+    typedef V Value;
+    typedef W Value_type;
+
+    typedef typename std::conditional<Opacity, TVersion, TNonopaqueVersion>::type Version_type;
+    typedef typename std::conditional<Opacity, TWrapped<Value>, TNonopaqueWrapped<Value>>::type wrapped_type;
+
+    typedef V write_value_type;
+
+    static constexpr typename Version_type::type invalid_bit = TransactionTid::user_bit;
+
+    static_assert(mass::is_trivially_copyable<K>::value, "OpenHashtable keys must be trivially copyable");
+    static_assert(mass::is_trivially_copyable<V>::value, "OpenHashtable values must be trivially copyable");
+
+private:
+    struct slot {
+        // kept across reuse of the slot, so it only ever moves forward
+        Version_type version;
+        Key key;
+        typename std::aligned_storage<sizeof(wrapped_type), alignof(wrapped_type)>::type value_;
+        wrapped_type& value() {
+            return *reinterpret_cast<wrapped_type*>(&value_);
+        }
+    };
+
+    static constexpr size_t cache_line = 64;
+    // bucket version, tags and overflow
+    static constexpr size_t header_size = sizeof(Version_type) + 8;
+    static constexpr unsigned slots_fit = (cache_line - header_size) / sizeof(slot);
+    static constexpr unsigned nslots = slots_fit > 7 ? 7 : (slots_fit ? slots_fit : 1);
+    static constexpr unsigned slot_mask = (1U << nslots) - 1;
+
+    // tag bytes: 0 never used, 1 deleted, otherwise 0x80 | 7 hash bits
+    static constexpr uint8_t tag_empty = 0;
+    static constexpr uint8_t tag_deleted = 1;
+
+    struct bucket {
+        // bumped whenever a key is added to one of this bucket's slots or
+        // displaced past it, so that a lookup that found a key absent
+        // stays that way at commit
+        Version_type version;
+        uint8_t tags[7];
+        // keys whose probe path passes this bucket but that live further
+        // on; lookups stop at a bucket where it is 0. Sticks at 255.
+        uint8_t overflow;
+        slot slots[nslots];
+    } __attribute__((aligned(cache_line)));
+
+    bucket* buckets_;
+    size_t nbuckets_;
+    Hash hasher_;
+    Pred pred_;
+
+    // used to mark whether a key is a bucket (for bucket version checks)
+    // or a slot (which will always have the lower 3 bits as 0)
+    static constexpr uintptr_t bucket_bit = 1U<<0;
+
+    static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
+
+public:
+    // `capacity` is the number of keys the table must hold
+    OpenHashtable(size_t capacity = Init_size, Hash h = Hash(), Pred p = Pred())
+        : hasher_(h), pred_(p) {
+        // keep buckets at most 3/4 full so that probes stay short
+        nbuckets_ = std::max(size_t(1), (capacity * 4 / 3 + nslots - 1) / nslots);
+        void* mem;
+        if (posix_memalign(&mem, cache_line, nbuckets_ * sizeof(bucket)) != 0)
+            throw std::bad_alloc();
+        buckets_ = static_cast<bucket*>(mem);
+        for (size_t i = 0; i < nbuckets_; ++i) {
+            bucket& b = buckets_[i];
+            new (&b.version) Version_type(0);
+            memset(b.tags, 0, sizeof(b.tags));
+            b.overflow = 0;
+            for (unsigned j = 0; j < nslots; ++j)
+                new (&b.slots[j].version) Version_type(Sto::initialized_tid() | invalid_bit);
+        }
+    }
+    ~OpenHashtable() {
+        for (size_t i = 0; i < nbuckets_; ++i)
+            for (unsigned j = 0; j < nslots; ++j)
+                if (is_full(buckets_[i].tags[j]))
+                    buckets_[i].slots[j].value().~wrapped_type();
+        free(buckets_);
+    }
+
+    inline size_t hash(const Key& k) {
+        // mix, since std::hash of an integer is the integer
+        uint64_t h = hasher_(k);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    inline size_t nbuckets() {
+        return nbuckets_;
+    }
+
+    static constexpr unsigned slots_per_bucket() {
+        return nslots;
+    }
+
+    // returns true if found false if not
+    template <typename KT, typename VT>
+    bool transGet(const KT& k, VT& retval) {
+        probe_versions probed;
+        slot* s = find(k, hash(k), &probed);
+        if (s) {
+            auto item = t_read_only_item(s);
+            if (!validity_check(item, s)) {
+                Sto::abort();
+                return false;
+            }
+#if READ_MY_WRITES
+            // deleted
+            if (has_delete(item)) {
+                return false;
+            }
+            if (item.has_write()) {
+                retval = item.template write_value<write_value_type>();
+                return true;
+            }
+#endif
+            retval = s->value().read(item, s->version);
+            // the slot may have been reused for another key since find()
+            if (!pred_(s->key, k))
+                Sto::abort();
+            return true;
+        } else {
+            observe_absent(probed);
+            return false;
+        }
+    }
+
+    // returns true if successful
+    bool transDelete(const Key& k) {
+        probe_versions probed;
+        slot* s = find(k, hash(k), &probed);
+        if (s) {
+            Version_type slotvers = s->version;
+            fence();
+            // the slot may have been reused for another key since find()
+            if (!pred_(s->key, k))
+                Sto::abort();
+            auto item = t_item(s);
+            bool valid = !(slotvers.value() & invalid_bit);
+#if READ_MY_WRITES
+            if (!valid && has_insert(item)) {
+                // deleting our own insert: free the slot now and just check
+                // for no insert at commit
+                _remove(s);
+                item.remove_read().remove_write().clear_flags(insert_bit | delete_bit);
+                probed.clear();
+                find(k, hash(k), &probed);
+                observe_absent(probed);
+                return true;
+            } else
+#endif
+            if (!valid) {
+                Sto::abort();
+                return false;
+            }
+#if READ_MY_WRITES
+            // we already deleted!
+            if (has_delete(item)) {
+                return false;
+            }
+#endif
+            item.observe(slotvers);
+            item.add_write().add_flags(delete_bit);
+            return true;
+        } else {
+            observe_absent(probed);
+            return false;
+        }
+    }
+
+private:
+    // returns true if item already existed, false if it did not
+    template <bool INSERT, bool SET, typename KT, typename VT>
+    bool trans_write(const KT& k, const VT& v) {
+        size_t h = hash(k);
+        bucket* home = nullptr;
+        bucket* b = nullptr;
+        Version_type prev_version;
+        slot* s;
+        probe_versions probed;
+        if (!INSERT)
+            s = find(k, h, &probed);
+        else
+            s = find_or_claim<false>(k, v, h, home, b, prev_version);
+        if (s && !b) {
+            if (INSERT)
+                unlock(home->version);
+            Version_type slotvers = s->version;
+            fence();
+            // the slot may have been reused for another key since find()
+            if (!pred_(s->key, k))
+                Sto::abort();
+            auto item = t_item(s);
+            if (!validity_check(item, s)) {
+                Sto::abort();
+                // unreachable (t.abort() raises an exception)
+                return false;
+            }
+#if READ_MY_WRITES
+            if (has_delete(item)) {
+                // delete-then-insert == update
+                if (INSERT) {
+                    item.clear_flags(delete_bit).clear_write().template add_write<write_value_type>(v);
+                }
+                return false;
+            }
+#endif
+            // make sure the item doesn't get deleted before us
+            item.observe(slotvers);
+            if (SET) {
+                item.template add_write<write_value_type>(v);
+#if READ_MY_WRITES
+                if (has_insert(item)) {
+                    // Updating the value here, as we won't update it during install
+                    s->value().write(v);
+                }
+#endif
+            }
+            return true;
+        } else if (!INSERT) {
+            observe_absent(probed);
+            return false;
+        }
+
+        // not there, so find_or_claim put it in the first free slot of
+        // its probe path
+        auto new_version = b->version.unlocked();
+        fence();
+        if (b != home)
+            unlock(b->version);
+        unlock(home->version);
+        // see if this bucket was previously read
+        auto bucket_item = Sto::check_item(this, pack_bucket(b));
+        if (bucket_item) {
+            bucket_item->update_read(prev_version, Version_type(new_version));
+        }
+        // s may already have an item: our own insert of k, deleted again
+        // (transDelete cleared it), or a read or write of the key s held
+        // before, which cannot validate now that claiming s changed its
+        // version
+        auto item = Sto::item(this, s);
+        bool stale = item.has_read() || item.has_write();
+        item.remove_read().clear_flags(delete_bit);
+        item.template add_write<write_value_type>(v);
+        // need to free this slot if we abort
+        item.add_flags(insert_bit);
+        if (stale)
+            Sto::abort();
+        return false;
+    }
+
+public:
+    template <typename KT, typename VT>
+    bool transPut(const KT& k, const VT& v) {
+        return trans_write</*insert*/true, /*set*/true>(k, v);
+    }
+
+    // returns true if successful
+    template <typename KT, typename VT>
+    bool transInsert(const KT& k, const VT& v) {
+        return !trans_write</*insert*/true, /*set*/false>(k, v);
+    }
+
+    template <typename KT, typename VT>
+    bool transUpdate(const KT& k, const VT& v) {
+        return trans_write</*insert*/false, /*set*/true>(k, v);
+    }
+
+    bool check(TransItem& item, Transaction&) override {
+        if (is_bucket(item)) {
+            bucket* b = bucket_key(item);
+            return b->version.check_version(item.template read_value<Version_type>());
+        }
+        slot* s = item.key<slot*>();
+        return s->version.check_version(item.template read_value<Version_type>());
+    }
+
+    bool lock(TransItem& item, Transaction& txn) override {
+        assert(!is_bucket(item));
+        slot* s = item.key<slot*>();
+        return txn.try_lock(item, s->version);
+    }
+
+    void install(TransItem& item, Transaction& t) override {
+        assert(!is_bucket(item));
+        slot* s = item.key<slot*>();
+        assert(s->version.is_locked());
+        if (item.flags() & delete_bit) {
+            s->version.set_version_locked(s->version.value() | invalid_bit);
+            // the slot becomes a tombstone at cleanup
+            return;
+        }
+        if (!(item.flags() & insert_bit)) {
+            Value& new_v = item.template write_value<write_value_type>();
+            s->value().write(new_v);
+        }
+        s->version.set_version(t.commit_tid()); // automatically sets valid to true
+        // convert nonopaque bucket version to a commit tid
+        if (Opacity && has_insert(item)) {
+            bucket* b = bucket_of(s);
+            lock(b->version);
+            if (b->version.value() & TransactionTid::nonopaque_bit)
+                b->version.set_version(t.commit_tid());
+            unlock(b->version);
+        }
+    }
+
+    void unlock(TransItem& item) override {
+        assert(!is_bucket(item));
+        unlock(item.key<slot*>()->version);
+    }
+
+    void cleanup(TransItem& item, bool committed) override {
+        if (committed ? has_delete(item) : has_insert(item)) {
+            slot* s = item.key<slot*>();
+            assert(s->version.value() & invalid_bit);
+            _remove(s);
+        }
+    }
+
+    // these are wrappers for concurrent.cc and other
+    // frameworks we use the hashtable in
+    Value transGet(Key k) {
+        Value v;
+        transGet(k, v);
+        return v;
+    }
+
+    Value unsafe_get(Key k) {
+        if (Value* p = readPtr(k))
+            return *p;
+        else
+            return Value();
+    }
+
+    Value* readPtr(const Key& k) {
+        slot* s = find(k, hash(k), nullptr);
+        return s ? &s->value().access() : NULL;
+    }
+
+    bool read(const Key& k, Value& retval) {
+        slot* s = find(k, hash(k), nullptr);
+        if (s)
+            retval = s->value().access();
+        return !!s;
+    }
+
+    // non-transactional insert-or-set; returns true if item already existed
+    template <bool Insert = true, bool Set = true>
+    bool put(const Key& k, const Value& val) {
+        size_t h = hash(k);
+        bucket* home;
+        bucket* b = nullptr;
+        Version_type prev_version;
+        slot* s;
+        if (Insert)
+            s = find_or_claim<true>(k, val, h, home, b, prev_version);
+        else {
+            home = &buckets_[bucket_index(h)];
+            lock(home->version);
+            s = find(k, h, nullptr);
+        }
+        if (b) {
+            if (b != home)
+                unlock(b->version);
+            unlock(home->version);
+            return false;
+        }
+        if (s && Set) {
+            lock(s->version);
+            s->value().access() = val;
+            s->version.inc_nonopaque_version();
+            unlock(s->version);
+        }
+        unlock(home->version);
+        return !!s;
+    }
+
+    // returns true if successfully inserted
+    bool insert(const Key& k, const Value& val) {
+        return !put<true, false>(k, val);
+    }
+
+    bool nontrans_insert(const Key& k, const Value& v) { return insert(k, v); }
+
+    bool nontrans_find(const Key& k, Value& v) { return read(k, v); }
+
+    void print_stats() {
+        size_t full = 0, deleted = 0, displaced = 0, overflowing = 0;
+        for (size_t i = 0; i < nbuckets_; ++i) {
+            overflowing += !!buckets_[i].overflow;
+            for (unsigned j = 0; j < nslots; ++j) {
+                uint8_t tag = buckets_[i].tags[j];
+                if (tag == tag_deleted)
+                    ++deleted;
+                else if (is_full(tag)) {
+                    ++full;
+                    if (bucket_index(hash(buckets_[i].slots[j].key)) != i)
+                        ++displaced;
+                }
+            }
+        }
+        printf("Buckets: %zu x %u slots, Full: %zu (%.1f%%), Tombstones: %zu, Not in home bucket: %zu, Overflowing buckets: %zu\n",
+               nbuckets_, nslots, full, 100.0 * full / (nbuckets_ * nslots), deleted, displaced, overflowing);
+    }
+
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{OpenHashtable<" << typeid(K).name() << "," << typeid(V).name() << "> " << (void*) this;
+        if (is_bucket(item)) {
+            w << ".b[" << (bucket_key(item) - buckets_) << "]";
+            if (item.has_read())
+                w << " R" << item.read_value<Version_type>();
+        } else {
+            slot* s = item.key<slot*>();
+            w << "[" << mass::print_value(s->key) << "]";
+            if (item.has_read())
+                w << " R" << item.read_value<Version_type>();
+            if (item.has_write())
+                w << " =" << mass::print_value(item.write_value<write_value_type>());
+        }
+        w << "}";
+    }
+
+private:
+    // versions of the buckets a failed lookup probed
+    typedef local_vector<std::pair<bucket*, Version_type>, 4> probe_versions;
+
+    static bool is_full(uint8_t tag) {
+        return tag & 0x80;
+    }
+    static uint8_t tag_of(size_t h) {
+        return 0x80 | (h & 0x7F);
+    }
+    // the high hash bits pick the bucket, the low ones the tag
+    size_t bucket_index(size_t h) const {
+        return (unsigned __int128) h * nbuckets_ >> 64;
+    }
+    size_t next_index(size_t i) const {
+        return i + 1 == nbuckets_ ? 0 : i + 1;
+    }
+    bucket* bucket_of(slot* s) const {
+        return &buckets_[(reinterpret_cast<char*>(s) - reinterpret_cast<char*>(buckets_)) / sizeof(bucket)];
+    }
+
+    // bit i set if tags[i] == tag (reads overflow too, then masks it off)
+    static unsigned match(const uint8_t* tags, uint8_t tag) {
+#ifdef __SSE2__
+        __m128i t = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(tags));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(t, _mm_set1_epi8(tag))) & slot_mask;
+#else
+        unsigned m = 0;
+        for (unsigned i = 0; i < nslots; ++i)
+            if (tags[i] == tag)
+                m |= 1U << i;
+        return m;
+#endif
+    }
+
+    // looks up k. If it is absent and `probed` is not null, `probed` gets
+    // the buckets the lookup went through, with their versions.
+    template <typename KT>
+    slot* find(const KT& k, size_t h, probe_versions* probed) {
+        uint8_t tag = tag_of(h);
+        size_t i = bucket_index(h);
+        for (size_t n = 0; n != nbuckets_; ++n, i = next_index(i)) {
+            bucket& b = buckets_[i];
+            Version_type vers = b.version;
+            fence();
+            for (unsigned m = match(b.tags, tag); m; m &= m - 1) {
+                slot& s = b.slots[__builtin_ctz(m)];
+                if (pred_(s.key, k))
+                    return &s;
+            }
+            if (probed)
+                probed->push_back(std::make_pair(&b, Version_type(vers.unlocked())));
+            if (!__atomic_load_n(&b.overflow, __ATOMIC_RELAXED))
+                break;
+        }
+        return nullptr;
+    }
+
+    // locks k's home bucket, which serializes inserts of k, and looks k up.
+    // If k is absent, claims a slot for it; `b` is then the slot's bucket,
+    // left locked along with home, and `prev_version` its version before
+    // the insert. If k is present, `b` is null and only home is locked.
+    template <bool markValid, typename KT, typename VT>
+    slot* find_or_claim(const KT& k, const VT& v, size_t h, bucket*& home, bucket*& b, Version_type& prev_version) {
+        home = &buckets_[bucket_index(h)];
+        lock(home->version);
+        while (1) {
+            b = nullptr;
+            if (slot* s = find(k, h, nullptr))
+                return s;
+            if (slot* s = claim_locked<markValid>(home, k, v, h, b, prev_version))
+                return s;
+            // claim_locked let go of home for a moment, so k may be there now
+        }
+    }
+
+    // puts k into the first free slot on its probe path, with home locked.
+    // Buckets are locked in index order: if the probe wrapped around to a
+    // bucket before home and that bucket is busy, this unlocks and relocks
+    // home and returns null. Every full bucket passed counts k in its
+    // overflow and gets a new version, so that other transactions' lookups
+    // that stopped there before see the change.
+    template <bool markValid, typename KT, typename VT>
+    slot* claim_locked(bucket* home, const KT& k, const VT& v, size_t h, bucket*& b, Version_type& prev_version) {
+        size_t i = home - buckets_;
+        for (size_t n = 0; n != nbuckets_; ++n, i = next_index(i)) {
+            b = &buckets_[i];
+            if (b > home)
+                lock(b->version);
+            else if (b < home && !b->version.try_lock()) {
+                drop_overflow(home - buckets_, i);
+                unlock(home->version);
+                relax_fence();
+                lock(home->version);
+                b = nullptr;
+                return nullptr;
+            }
+            unsigned free = match(b->tags, tag_empty) | match(b->tags, tag_deleted);
+            if (!free) {
+                Version_type passed_version(b->version.unlocked());
+                add_overflow(*b);
+                b->version.inc_nonopaque_version();
+                // a transaction's own absent lookups through b still hold
+                if (!markValid)
+                    if (auto bucket_item = Sto::check_item(this, pack_bucket(b)))
+                        bucket_item->update_read(passed_version, Version_type(b->version.unlocked()));
+                if (b != home)
+                    unlock(b->version);
+                continue;
+            }
+            prev_version = Version_type(b->version.unlocked());
+            unsigned j = __builtin_ctz(free);
+            slot& s = b->slots[j];
+            // a transaction may still hold the slot's old element locked
+            lock(s.version);
+            s.version.inc_nonopaque_version();
+            if (markValid)
+                s.version.set_version_locked(s.version.value() & ~invalid_bit);
+            else
+                s.version.set_version_locked(s.version.value() | invalid_bit);
+            s.key = k;
+            new (&s.value_) wrapped_type(v);
+            unlock(s.version);
+            fence();
+            b->tags[j] = tag_of(h);
+            b->version.inc_nonopaque_version();
+            return &s;
+        }
+        always_assert(false && "OpenHashtable is full");
+        return nullptr;
+    }
+
+    static void add_overflow(bucket& b) {
+        uint8_t c = __atomic_load_n(&b.overflow, __ATOMIC_RELAXED);
+        while (c != 255 && !__atomic_compare_exchange_n(&b.overflow, &c, uint8_t(c + 1), true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            /* retry */;
+    }
+    // takes one key out of the overflow counts of buckets [from, to)
+    void drop_overflow(size_t from, size_t to) {
+        for (size_t i = from; i != to; i = next_index(i)) {
+            bucket& b = buckets_[i];
+            uint8_t c = __atomic_load_n(&b.overflow, __ATOMIC_RELAXED);
+            while (c != 255 && !__atomic_compare_exchange_n(&b.overflow, &c, uint8_t(c - 1), true,
+                                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                /* retry */;
+        }
+    }
+
+    // turns a slot into a tombstone. used by transaction system
+    void _remove(slot* s) {
+        bucket* b = bucket_of(s);
+        size_t home = bucket_index(hash(s->key));
+        lock(b->version);
+        b->tags[s - b->slots] = tag_deleted;
+        s->value().~wrapped_type();
+        unlock(b->version);
+        // only now may lookups for the key stop short of b
+        drop_overflow(home, b - buckets_);
+    }
+
+    void observe_absent(const probe_versions& probed) {
+        for (auto& p : probed)
+            Sto::item(this, pack_bucket(p.first)).observe(p.second);
+    }
+
+    bool has_delete(const TransItem& item) {
+        return item.flags() & delete_bit;
+    }
+
+    bool has_insert(const TransItem& item) {
+        return item.flags() & insert_bit;
+    }
+
+    bool validity_check(const TransItem& item, slot* s) {
+        return has_insert(item) || !(s->version.value() & invalid_bit);
+    }
+
+    static bool is_bucket(const TransItem& item) {
+        return item.key<uintptr_t>() & bucket_bit;
+    }
+    static bucket* bucket_key(const TransItem& item) {
+        assert(is_bucket(item));
+        return reinterpret_cast<bucket*>(item.key<uintptr_t>() & ~bucket_bit);
+    }
+    static void* pack_bucket(bucket* b) {
+        return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(b) | bucket_bit);
+    }
+
+    static void lock(Version_type& v) {
+        v.lock();
+    }
+    static void unlock(Version_type& v) {
+        v.unlock();
+    }
+
+    TransProxy t_item(slot* s) {
+        return Sto::item(this, s);
+    }
+
+    TransProxy t_read_only_item(slot* s) {
+#if READ_MY_WRITES
+        return Sto::read_item(this, s);
+#else
+        return Sto::fresh_item(this, s);
+#endif
+    }
+};
@@ -3,11 +3,15 @@
 #include "TWrapped.hh"
 
 #include "OptimisticLockCoupling/Tree.h"
+#include "ARTRoot.hh"
 #include "Key.h"
+#include "CompactKey.hh"
 
 #include "measure_latencies.hh"
 #include <map>
 #include <list>
+#include <vector>
+#include <cstdint>
 
 /* 
  *    A transactional version of ART running on top of STO
@@ -23,7 +27,7 @@ using namespace std;
 #define DEBUG 0
 #define DEBUG_VALIDATION 0
 #define MEASURE_ABORTS 1
-#define ABSENT_VALIDATION 1 // 1 for node set, 2 for node set with absent keys, 3 for absent keys and lookup starting from target node, 4 for key set
+#define ABSENT_VALIDATION 1 // 1 for node set, 2 for node set with absent keys, 3 for absent keys and lookup starting from target node, 4 for key set, 5 for range set
 
 #if DEBUG == 1
     #define PRINT_DEBUG(...) {printf(__VA_ARGS__);}
@@ -53,7 +57,7 @@ static unsigned accessed_nodes_num=0;
 
 
 #if MEASURE_ABORTS == 1
-static const unsigned aborts_sz = 10;
+static const unsigned aborts_sz = 11;
 uint64_t aborts[N_THREADS][aborts_sz];
 static string aborts_descr[aborts_sz];
 #define INCR(arg) arg+=1;
@@ -61,10 +65,13 @@ static string aborts_descr[aborts_sz];
     #define INCR(arg) {}
 #endif
 
+// uses ABSENT_VALIDATION, aborts[] and INCR
+#include "TARTCursor.hh"
+
 #if ABSENT_VALIDATION == 2 || ABSENT_VALIDATION == 3
 // That's the list of absent keys for a particular node. It will be stored in the value of the TItem for a node
 typedef struct absent_keys {
-    Key * k;
+    compact_key * k;
     struct absent_keys* next;
 }absent_keys_t;
 #endif
@@ -80,6 +87,9 @@ class TART : public Tree, TObject {
 
 	static constexpr uintptr_t nodeset_bit = 1LU << 63;
     static constexpr uintptr_t keyset_bit = 1LU <<62;
+    static constexpr uintptr_t rangeset_bit = 1LU << 61;
+
+    struct key_range;
 
 public:
 
@@ -96,6 +106,7 @@ public:
             aborts_descr[7] = "update AVN failure - insert key, failure while updating node 2";
             aborts_descr[8] = "abort exception handled (hard opacity check, etc.)";
             aborts_descr[9] = "key inserted concurrently";
+            aborts_descr[10] = "range set validation failure";
         #endif
     }
 
@@ -142,16 +153,22 @@ public:
     }
 
     lookup_res t_lookupRange(const Key& start, const Key& end, Key & continueKey, TID result[], std::size_t resultSize, std::size_t &resultsFound, ThreadInfo &threadEpocheInfo) {
-        trans_info_range_t* t_info = new trans_info_range_t();
-        memset(t_info, 0, sizeof(trans_info_range_t));
+        trans_info_range_t t_info;
+        memset(&t_info, 0, sizeof(trans_info_range_t));
+        // committed records seen, for the range set entry (ABSENT_VALIDATION 5)
+        uint64_t rs_count = 0, rs_fp = 0;
         // adds a key in the read set
-        t_info->addKeyRS = [this](TID tid){
+        t_info.addKeyRS = [this, &rs_count, &rs_fp](TID tid){
             record* rec = reinterpret_cast<record*>(tid);
             auto item = Sto::item(this, rec);
             if(!rec->valid() && !has_insert(item)){ // key record is poisoned by a concurrent transaction, abort!
                 INCR(aborts[TThread::id()][4])
                     return false;
                 }
+                if(rec->valid() && !rec->deleted){
+                    ++rs_count;
+                    rs_fp ^= rs_fingerprint(rec);
+                }
                 if(has_delete(item)){ // current transaction already marked for deletion, reply as it is absent!
                     return true;
                 }
@@ -160,16 +177,20 @@ public:
                 return true;
         };
         // adds a parent node in the node set together with its version number
-        t_info->addNodeNS = [this] (const N* node, uint64_t node_vers){
+        t_info.addNodeNS = [this] (const N* node, uint64_t node_vers){
             #if ABSENT_VALIDATION == 1
                 ns_add_node(node, node_vers);
             #endif
             return true;
         };
-        bool toContinue = lookupRange(start, end, continueKey, result, resultSize, resultsFound, threadEpocheInfo, t_info);
-        if(t_info->abort){
+        bool toContinue = lookupRange(start, end, continueKey, result, resultSize, resultsFound, threadEpocheInfo, &t_info);
+        if(t_info.abort){
             return lookup_res(0, false);
         }
+        #if ABSENT_VALIDATION == 5
+        // only [start, continueKey) was scanned if the result buffer filled up
+        rs_add_range(start, toContinue ? continueKey : end, rs_count, rs_fp);
+        #endif
         return lookup_res(0, true);
     }
 
@@ -179,37 +200,37 @@ public:
 
 	lookup_res t_lookup(const Key& k, ThreadInfo& threadEpocheInfo, bool validate){
         PRINT_DEBUG("Lookup key %s\n", keyToStr(k).c_str())
-		trans_info_t* t_info = new trans_info_t();
-		memset(t_info, 0, sizeof(trans_info_t));
-        TID tid = lookup(k, threadEpocheInfo, t_info);
+		trans_info_t t_info;
+		memset(&t_info, 0, sizeof(trans_info_t));
+        TID tid = lookup(k, threadEpocheInfo, &t_info);
         #if MEASURE_ART_NODE_ACCESSES == 1
         if(validate){
-            accessed_nodes_sum+=t_info->accessed_nodes;
+            accessed_nodes_sum+=t_info.accessed_nodes;
             accessed_nodes_num++;
         }
         #endif
-		if(t_info->check_key){ // call the TART check Key! (casting from rec*)
+		if(t_info.check_key){ // call the TART check Key! (casting from rec*)
 			tid = checkKeyFromRec(tid, k);
 		}
 		if (tid == 0){ // not found. Add parent in the nodeset, or key in keyset
             PRINT_DEBUG("Not found!\n")
             if(validate){ // only add parent in the nodeset if we want to validate (TART RW, not TART compacted)
                 #if ABSENT_VALIDATION == 1
-                ns_add_node(std::get<0>(t_info->updated_node1), std::get<1>(t_info->updated_node1));
+                ns_add_node(std::get<0>(t_info.updated_node1), std::get<1>(t_info.updated_node1));
                 //stringstream ss;
-                //ss<<TThread::id()<<": Key not found, adding node "<< std::get<0>(t_info->updated_node1) << ", vers "<< std::get<1>(t_info->updated_node1) <<" to node set\n";
+                //ss<<TThread::id()<<": Key not found, adding node "<< std::get<0>(t_info.updated_node1) << ", vers "<< std::get<1>(t_info.updated_node1) <<" to node set\n";
                 //cout<<ss.str()<<std::flush;
                 #elif ABSENT_VALIDATION == 2 || ABSENT_VALIDATION == 3
-                ns_add_node(t_info->cur_node, k);
+                ns_add_node(t_info.cur_node, k);
                 #elif ABSENT_VALIDATION == 4
                 ks_add_key(k);
+                #elif ABSENT_VALIDATION == 5
+                rs_add_key(k);
                 #endif
             }
-            delete t_info;
 			return lookup_res(0, true);
 		}
 		record* rec = reinterpret_cast<record*>(tid);
-        delete t_info;
         if(validate) {
             auto item = Sto::item(this, rec);
             if(!rec->valid() && !has_insert(item)){
@@ -228,42 +249,67 @@ public:
 			return lookup_res(0, false);
 	}
 
+    // Looks up keys[0..n) and stores each key's value in results[i] (0 if
+    // absent). Returns false if the transaction must abort. Up to
+    // multi_lookup_group traversals run interleaved: each one steps down a
+    // single node and prefetches the next before the others step, so the
+    // cache misses of different keys overlap instead of being taken one
+    // after another. Keys are taken multi_lookup_batch at a time; the
+    // found records and absent-key nodes of a batch then go into the read
+    // set in one pass, with the same checks as t_lookup.
+    bool t_multi_lookup(const Key* const keys[], std::size_t n, TID results[], ThreadInfo& threadEpocheInfo){
+        for(std::size_t i = 0; i < n; i += multi_lookup_batch)
+            if(!multi_lookup_batch_run(keys + i, std::min<std::size_t>(n - i, multi_lookup_batch),
+                                       results + i, threadEpocheInfo))
+                return false;
+        return true;
+    }
+
     
     // ins_res is <inserted, ok-to-commit>, where inserted is true when the new key caused an insertion and false when it was an udpate. ok-to-commit is false when the transaction must abort at run-time.
 	ins_res t_insert(const Key & k, TID tid, ThreadInfo &epocheInfo){
-        trans_info_t* t_info = new trans_info_t();
-		memset(t_info, 0, sizeof(trans_info_t));
+        trans_info_t t_info;
+		memset(&t_info, 0, sizeof(trans_info_t));
 		//stringstream ss;
         //ss<<"Size: "<< sizeof(trans_info_t)<<endl;
         //cout<<ss.str();
         PRINT_DEBUG("Transactionally Inserting (key:%s, tid:%lu)\n", keyToStr(k).c_str(), tid)
-		insert(k, tid, epocheInfo, t_info); 
-		N* n = t_info->cur_node;
-		N* l_n = t_info->l_node;
-		N* l_p_n = t_info->l_parent_node;
+		insert(k, tid, epocheInfo, &t_info); 
+		N* n = t_info.cur_node;
+		N* l_n = t_info.l_node;
+		N* l_p_n = t_info.l_parent_node;
         N* updated_nodes [2] ;
         bzero(updated_nodes, 2* sizeof(N*));
-        updated_nodes[0] = std::get<0>(t_info->updated_node1);
-        updated_nodes[1] = std::get<0>(t_info->updated_node2);
-		uint8_t keyslice = t_info->keyslice;
+        updated_nodes[0] = std::get<0>(t_info.updated_node1);
+        updated_nodes[1] = std::get<0>(t_info.updated_node2);
+		uint8_t keyslice = t_info.keyslice;
 
         #if ABSENT_VALIDATION == 1
         uint64_t updated_nodes_v [2];
-        updated_nodes_v[0] = std::get<1>(t_info->updated_node1);
-        updated_nodes_v[1] = std::get<1>(t_info->updated_node2);
+        updated_nodes_v[0] = std::get<1>(t_info.updated_node1);
+        updated_nodes_v[1] = std::get<1>(t_info.updated_node2);
         #endif	
 	
-        if(t_info->updatedVal > 0){ // it is an update
+        if(t_info.updatedVal > 0){ // it is an update
             //stringstream ss;
             //ss<<"Update\n";
             //cout<<ss.str();
-            record* rec = reinterpret_cast<record*>(t_info->prevVal);
+            record* rec = reinterpret_cast<record*>(t_info.prevVal);
             auto item = Sto::item(this, rec);
             if(!rec->valid() && !has_insert(item)){
                 INCR(aborts[TThread::id()][4])
-                delete t_info;
                 return ins_res(false, false);
             }
+            // A committed remove (e.g. a HybridART merge batch) leaves the
+            // record behind until it is unlinked; writing into it would be
+            // lost. Observing the version makes a remove that commits
+            // after this point fail our check.
+            if(rec->deleted){
+                INCR(aborts[TThread::id()][4])
+                return ins_res(false, false);
+            }
+            if(!has_insert(item))
+                item.observe(rec->version);
             // UPDATE: We do not need to update AVN in node set as it was an update of existing key and thus AVN didn't change!
             // update AVN in node set, if exists
             // Use the version number after the unlock! (+2)
@@ -271,18 +317,16 @@ public:
             if(! ns_update_node_AVN(updated_nodes[0], updated_nodes_v[0], updated_nodes[0]->getVersion()+2)) {
                 PRINT_DEBUG("UPDATE NODE FAIL!\n")
                 INCR(aborts[TThread::id()][5])
-                if(t_info->w_unlock_obsolete)
+                if(t_info.w_unlock_obsolete)
                     l_n->writeUnlockObsolete();
                 else
                     l_n->writeUnlock();
-                delete t_info;
                 return ins_res(false, false);
             }
             #endif
             */
-            item.add_write(t_info->updatedVal);
+            item.add_write(t_info.updatedVal);
             // TODO: In some runs l_n was null! Check it!
-            delete t_info;
             return ins_res(false, true);
         }
 
@@ -317,7 +361,7 @@ public:
 		// and we will not detect it!
 		// also check whether node is migrated! Do not update its AVN if it is!
 		if(!l_n->isMigrated() && (! ns_update_node_AVN(updated_nodes[0], updated_nodes_v[0], updated_nodes[0]->getVersion()+2))) {
-			if(t_info->w_unlock_obsolete)
+			if(t_info.w_unlock_obsolete)
                 l_n->writeUnlockObsolete();
             else
                 l_n->writeUnlock();
@@ -331,7 +375,7 @@ public:
 		}
         if(updated_nodes[1] != nullptr){
             if(! ns_update_node_AVN(updated_nodes[1], updated_nodes_v[1], updated_nodes[1]->getVersion()+2)) {
-                if(t_info->w_unlock_obsolete)
+                if(t_info.w_unlock_obsolete)
                     l_n->writeUnlockObsolete();
                 else
                     l_n->writeUnlock();
@@ -346,7 +390,7 @@ public:
         }
         #elif ABSENT_VALIDATION == 2 || ABSENT_VALIDATION == 3
         // we must remove that newly inserted key from the current node in the node set, if exists
-        auto nodeset_item = Sto::item(this, get_nodeset_key(n)); //n is t_info->cur_node
+        auto nodeset_item = Sto::item(this, get_nodeset_key(n)); //n is t_info.cur_node
         if(nodeset_item.has_read()){ // remove the newly inserted key from the absent key list!
             //cout <<"Inserting previously absent key\n";
             absent_keys_t* keys_list_cur = nodeset_item.template read_value<absent_keys_t*>();
@@ -354,17 +398,13 @@ public:
             while(keys_list_cur != nullptr) {
                 if(keys_list_cur->k == nullptr)
                     break;
-                if(*keys_list_cur->k == k){ // remove that key
+                if(*keys_list_cur->k == k){ // remove that key (its memory goes with the transaction's key arena)
                     if(keys_list_prev == keys_list_cur){ // found in head of the list
-                        delete keys_list_cur->k;
                         nodeset_item.update_read(nodeset_item.template read_value<absent_keys_t*>(), keys_list_cur->next); // change head of the list as the next element
-                        delete keys_list_cur;
                         break;
                     }
                     else {
                         keys_list_prev->next = keys_list_cur->next;
-                        delete keys_list_cur->k;
-                        delete keys_list_cur;
                         break;
                     }
                 }
@@ -374,7 +414,7 @@ public:
         }
         #endif
 		PRINT_DEBUG("-- Unlocking node %p\n", l_n);
-		if(t_info->w_unlock_obsolete)
+		if(t_info.w_unlock_obsolete)
             l_n->writeUnlockObsolete();
         else
             l_n->writeUnlock();
@@ -391,38 +431,36 @@ public:
 		//rec_tmp = item_tmp.key<record*>();
 		//PRINT_DEBUG("Inserted key %s\n", keyToStr(rec_tmp->key).c_str())
         #if MEASURE_TREE_SIZE == 1
-        if(t_info->addedSize > 0)
-            tree_sz[TThread::id()] += t_info->addedSize;
-        //cout<<"Adding "<<t_info->addedSize<<endl;
+        if(t_info.addedSize > 0)
+            tree_sz[TThread::id()] += t_info.addedSize;
+        //cout<<"Adding "<<t_info.addedSize<<endl;
         #endif
-        delete t_info;
         return ins_res(true, true);
 		abort:
-            delete t_info;
 			return ins_res(false, false);
 	}
 
 	rem_res t_remove(const Key & k, TID tid, ThreadInfo &threadEpocheInfo){
 		bool tid_mismatch = false;
-		trans_info_t* t_info = new trans_info_t();
-		memset(t_info, 0, sizeof(trans_info_t));
+		trans_info_t t_info;
+		memset(&t_info, 0, sizeof(trans_info_t));
         PRINT_DEBUG("Transactionally Removing (key:%s, tid:%lu)\n", keyToStr(k).c_str(), tid)
-        TID lookup_tid = lookup(k, threadEpocheInfo, t_info);
-        if(t_info->check_key){ // call the TART check Key! (casting from rec*)
+        TID lookup_tid = lookup(k, threadEpocheInfo, &t_info);
+        if(t_info.check_key){ // call the TART check Key! (casting from rec*)
             lookup_tid = checkKeyFromRec(lookup_tid, k); 
         }
 		if(lookup_tid == 0){ // not found, add to node set!
 			#if ABSENT_VALIDATION == 1
-            ns_add_node(std::get<0>(t_info->updated_node1), std::get<1>(t_info->updated_node1));
+            ns_add_node(std::get<0>(t_info.updated_node1), std::get<1>(t_info.updated_node1));
             #elif ABSENT_VALIDATION == 2 || ABSENT_VALIDATION == 3
-            ns_add_node(t_info->cur_node, k);
+            ns_add_node(t_info.cur_node, k);
             #elif ABSENT_VALIDATION == 4
             ks_add_key(k);
+            #elif ABSENT_VALIDATION == 5
+            rs_add_key(k);
             #endif
-            delete t_info;
 			return rem_res(false, true);
 		}
-        delete t_info;
 		record* rec = reinterpret_cast<record*>(lookup_tid);
 		if(rec->val != tid){ // that's the behavior of ART insert: If the encountered tuple id is different than the supplied one, return
 			tid_mismatch = true;
@@ -446,8 +484,169 @@ public:
 		return rem_res(true, true);
 	}
 
+    typedef tart_cursor<TART> cursor;
+    friend class tart_cursor<TART>;
+
+    // Opens a cursor over [start, end); see cursor.
+    cursor t_scan(const Key& start, const Key& end, ThreadInfo& ti, bool reverse = false,
+                  std::size_t offset = 0, std::size_t limit = SIZE_MAX){
+        return cursor(*this, start, end, ti, reverse, offset, limit);
+    }
+
     private:
 
+    static constexpr unsigned multi_lookup_group = 8;
+    // keys per t_multi_lookup pass; bounds its stack use
+    static constexpr std::size_t multi_lookup_batch = 64;
+
+    // outcome of one t_multi_lookup traversal: the key's record, or the
+    // node (and its version) where the key was found absent
+    struct multi_lookup_state {
+        record* rec;
+        N* node;
+        uint64_t vers;
+    };
+
+    // an in-flight t_multi_lookup traversal
+    struct multi_lookup_slot {
+        std::size_t i;      // key index
+        const Key* key;
+        N* node;            // next node to visit, already prefetched
+        uint32_t level;
+    };
+
+    static void prefetch_node(const void* p){
+        // the header, prefix and first keys/children of an inner node
+        __builtin_prefetch(p);
+        __builtin_prefetch(reinterpret_cast<const char*>(p) + 64);
+    }
+
+    void multi_lookup_start(multi_lookup_slot& slot, std::size_t i, const Key* const keys[]){
+        slot.i = i;
+        slot.key = keys[i];
+        slot.node = root_node();
+        slot.level = 0;
+    }
+
+    // Visits slot.node. Returns true when the traversal is done and
+    // `st` holds its outcome; otherwise moves the slot to the child,
+    // which is prefetched for the next round. A node that changed
+    // under us restarts the traversal from the root, like ART_OLC's
+    // lookup.
+    bool multi_lookup_step(multi_lookup_slot& slot, multi_lookup_state& st){
+        N* node = slot.node;
+        const Key& k = *slot.key;
+        bool needRestart = false;
+        uint64_t v = node->readLockOrRestart(needRestart);
+        if(needRestart)
+            goto restart;
+        {
+            // only the stored part of the prefix can be compared here;
+            // the leaf's full key is checked below
+            uint32_t plen = node->getPrefixLength();
+            const uint8_t* prefix = node->getPrefix();
+            uint32_t cmp_len = std::min<uint32_t>(plen, maxStoredPrefixLength);
+            bool absent = false;
+            for(uint32_t j = 0; j < cmp_len; ++j)
+                if(slot.level + j >= k.getKeyLen() || prefix[j] != k[slot.level + j]){
+                    absent = true;
+                    break;
+                }
+            uint32_t level = slot.level + plen;
+            N* child = nullptr;
+            if(!absent && level < k.getKeyLen())
+                child = N::getChild(k[level], node);
+            node->readUnlockOrRestart(v, needRestart);
+            if(needRestart)
+                goto restart;
+            if(!child){
+                st.rec = nullptr;
+                st.node = node;
+                st.vers = v;
+                return true;
+            }
+            if(N::isLeaf(child)){
+                TID tid = checkKeyFromRec(N::getLeaf(child), k);
+                if(tid == 0){
+                    st.rec = nullptr;
+                    st.node = node;
+                    st.vers = v;
+                } else {
+                    st.rec = reinterpret_cast<record*>(tid);
+                    __builtin_prefetch(st.rec);
+                }
+                return true;
+            }
+            prefetch_node(child);
+            slot.node = child;
+            slot.level = level + 1;
+            return false;
+        }
+    restart:
+        slot.node = root_node();
+        slot.level = 0;
+        return false;
+    }
+
+    // t_multi_lookup for n <= multi_lookup_batch keys
+    bool multi_lookup_batch_run(const Key* const keys[], std::size_t n, TID results[], ThreadInfo& threadEpocheInfo){
+        multi_lookup_slot slots[multi_lookup_group];
+        multi_lookup_state states[multi_lookup_batch];
+        {
+            EpocheGuardReadonly epocheGuard(threadEpocheInfo);
+            std::size_t next = 0, active = 0;
+            for(unsigned s = 0; s < multi_lookup_group && next < n; ++s, ++active)
+                multi_lookup_start(slots[s], next++, keys);
+            while(active){
+                for(unsigned s = 0; s < multi_lookup_group; ++s){
+                    multi_lookup_slot& slot = slots[s];
+                    if(!slot.node || !multi_lookup_step(slot, states[slot.i]))
+                        continue;
+                    // traversal done: refill the slot with the next key
+                    if(next < n)
+                        multi_lookup_start(slot, next++, keys);
+                    else {
+                        slot.node = nullptr;
+                        --active;
+                    }
+                }
+            }
+        }
+
+        bool ok = true;
+        for(std::size_t i = 0; i < n; ++i){
+            multi_lookup_state& st = states[i];
+            results[i] = 0;
+            if(!st.rec){
+                #if ABSENT_VALIDATION == 1
+                ns_add_node(st.node, st.vers);
+                #elif ABSENT_VALIDATION == 2 || ABSENT_VALIDATION == 3
+                ns_add_node(st.node, *keys[i]);
+                #elif ABSENT_VALIDATION == 4
+                ks_add_key(*keys[i]);
+                #elif ABSENT_VALIDATION == 5
+                rs_add_key(*keys[i]);
+                #endif
+                continue;
+            }
+            auto item = Sto::item(this, st.rec);
+            if(!st.rec->valid() && !has_insert(item)){
+                INCR(aborts[TThread::id()][4])
+                ok = false;
+                break;
+            }
+            if(has_delete(item))
+                continue;
+            item.observe(st.rec->version);
+            results[i] = st.rec->val;
+        }
+        return ok;
+    }
+
+    N* root_node(){
+        return art_root(*this);
+    }
+
     // For ABSENT_VALIDATION 1
 	#if ABSENT_VALIDATION == 1
     // Adds a node and its AVN in the node set
@@ -488,9 +687,8 @@ public:
         //ss<<TThread::id()<< ": Adding absent key "<< keyToStr(key) <<endl;
         //cout<<ss.str();
         if(!item.has_read()){ // create new absent keys list
-            absent_keys_t* keys_list = new absent_keys_t;
-            bzero(keys_list, sizeof(absent_keys_t));
-            keys_list->k = copy_key(key);
+            absent_keys_t* keys_list = key_arena::make<absent_keys_t>();
+            keys_list->k = compact_key::make(key);
             //cout<<"Add read!\n";
             item.add_read(keys_list);
         }
@@ -499,18 +697,16 @@ public:
             absent_keys_t* keys_list_before = item.item().template read_value<absent_keys_t*>();
             absent_keys_t* keys_list = keys_list_before;
             if(keys_list == nullptr){ // this can be true if we deleted a key due to insert!
-                absent_keys_t* keys_list = new absent_keys_t;
-                bzero(keys_list, sizeof(absent_keys_t));
-                keys_list->k = copy_key(key);
+                absent_keys_t* keys_list = key_arena::make<absent_keys_t>();
+                keys_list->k = compact_key::make(key);
                 //cout<<"Update read!\n";
                 item.update_read(keys_list_before, keys_list);
             }
             else {
                 while(keys_list->next != nullptr)
                     keys_list = keys_list->next;
-                absent_keys_t* new_key = new absent_keys_t;
-                bzero(new_key, sizeof(absent_keys_t));
-                new_key->k = copy_key(key);
+                absent_keys_t* new_key = key_arena::make<absent_keys_t>();
+                new_key->k = compact_key::make(key);
                 keys_list->next = new_key;
                 /*unsigned i=1;
                 while(keys_list_before->next != nullptr){
@@ -536,24 +732,17 @@ public:
     }
 
 
-    Key* copy_key(const Key& k){
-        Key* key = new Key;
-        bzero(key, sizeof(Key));
-        key->set((const char*)&k[0], k.getKeyLen());
-        return key;
-    }
-
     // For ABSENT_VALIDATION 4
     // Adds a key to the key set
     #if ABSENT_VALIDATION == 4
     void ks_add_key(const Key& k){
-        Key* key = copy_key(k);
+        compact_key* key = compact_key::make(k);
         auto item = Sto::item(this, get_keyset_key(key));
         if(!item.has_read()){
             item.add_read(0);
         }
     }
-    static uintptr_t get_keyset_key(Key* key){
+    static uintptr_t get_keyset_key(compact_key* key){
         return reinterpret_cast<uintptr_t>(key) | keyset_bit;
     }
 
@@ -561,11 +750,80 @@ public:
         return (item.key<uintptr_t>() & keyset_bit) != 0;
     }
     
-    Key* get_key(uintptr_t k){
-        return reinterpret_cast<Key*>(k & ~keyset_bit);
+    compact_key* get_key(uintptr_t k){
+        return reinterpret_cast<compact_key*>(k & ~keyset_bit);
+    }
+    #endif
+
+    // For ABSENT_VALIDATION 5
+    // The range set holds the key intervals [lo, hi) that the transaction
+    // found empty or scanned, each with a count and fingerprint of the
+    // committed records in it. At commit the interval is scanned again
+    // and must hold the same records: only an insert or delete inside
+    // the interval aborts us, not any change to the nodes it spans.
+    struct key_range {
+        compact_key lo, hi;
+        uint64_t count, fp;
+    };
+
+    static uint64_t rs_fingerprint(const record* rec){
+        return reinterpret_cast<uintptr_t>(rec);
+    }
+
+    #if ABSENT_VALIDATION == 5
+    key_range* rs_add_range(const Key& lo, const Key& hi, uint64_t count, uint64_t fp){
+        // lives until this transaction is over, committed or not
+        key_range* r = key_arena::make<key_range>();
+        r->lo.assign(lo);
+        r->hi.assign(hi);
+        r->count = count;
+        r->fp = fp;
+        auto item = Sto::item(this, get_rangeset_key(r));
+        item.add_read(0);
+        return r;
+    }
+
+    // an absent key is the interval [k, k+"\0")
+    void rs_add_key(const Key& k){
+        Key succ;
+        key_successor(k, succ);
+        rs_add_range(k, succ, 0, 0);
+    }
+
+    static uintptr_t get_rangeset_key(key_range* r){
+        return reinterpret_cast<uintptr_t>(r) | rangeset_bit;
+    }
+
+    bool is_in_rangeset(TransItem& item){
+        return (item.key<uintptr_t>() & rangeset_bit) != 0;
+    }
+
+    key_range* get_range(uintptr_t k){
+        return reinterpret_cast<key_range*>(k & ~rangeset_bit);
+    }
+
+    bool rs_check(const key_range* r){
+        Key lo, hi;
+        r->lo.load(lo);
+        r->hi.load(hi);
+        auto ti = getThreadInfo();
+        cursor c(*this, lo, hi, ti);
+        uint64_t count = 0, fp = 0;
+        while(c.next()){
+            ++count;
+            fp ^= rs_fingerprint(c.rec_);
+        }
+        return !c.aborted() && count == r->count && fp == r->fp;
     }
     #endif
 
+    // the smallest key greater than k
+    static void key_successor(const Key& k, Key& succ){
+        std::string s((const char*)&k[0], k.getKeyLen());
+        s.push_back('\0');
+        succ.set(s.data(), s.size());
+    }
+
 	static bool has_insert(const TransItem& item){
 		return item.flags() & insert_bit;
 	}
@@ -583,6 +841,8 @@ public:
         assert(!is_in_nodeset(item));
         #elif ABSENT_VALIDATION == 4
         assert(!is_in_keyset(item));
+        #elif ABSENT_VALIDATION == 5
+        assert(!is_in_rangeset(item));
         #endif
         record* rec = item.key<record*>();
 		auto res = txn.try_lock(item, rec->version);
@@ -592,18 +852,6 @@ public:
         return res;
     }
 
-    #if ABSENT_VALIDATION == 2 || ABSENT_VALIDATION == 3
-    void clear_absent_keys_list(absent_keys_t* keys_list){
-        absent_keys_t* keys_list_cur;
-        while(keys_list != nullptr){
-            keys_list_cur = keys_list;
-            keys_list = keys_list->next;
-            delete keys_list_cur->k;
-            delete keys_list_cur;
-        }
-    }
-    #endif
-
 	bool check(TransItem& item, Transaction& ){
         INIT_COUNTING
         PRINT_DEBUG("Check\n")
@@ -638,42 +886,40 @@ public:
             unsigned i=0;
             while(keys_list!= nullptr){
                 if(keys_list->k != nullptr){
-                    trans_info_t* t_info = new trans_info_t();
-                    memset(t_info, 0, sizeof(trans_info_t));
+                    Key key;
+                    keys_list->k->load(key);
+                    trans_info_t t_info;
+                    memset(&t_info, 0, sizeof(trans_info_t));
                     auto t = this->getThreadInfo();
                     #if ABSENT_VALIDATION == 2
-                    TID tid = lookup(*keys_list->k, t, t_info);
+                    TID tid = lookup(key, t, &t_info);
                     #elif ABSENT_VALIDATION == 3
                     N* node = get_node(item.key<uintptr_t>());
                     if(node->isMigrated() || node->isObsolete(node->getVersion())) { // node migrated or became obsolete in the meantime! Abort!
                         return false;
                     }
-                    TID tid = lookup(*keys_list->k, t, t_info, node);
+                    TID tid = lookup(key, t, &t_info, node);
                     //  when looking up for a key from a startNode in ABSENT_VALIDATION 2 or 3 there is a case that the node
                     //   is obsolete and will always stay obsolete. Abort the transaction and the new attempt will end up in the new node.
-                    if(t_info->shouldAbort){
-                        delete t_info;
+                    if(t_info.shouldAbort){
                         return false;
                     }
                     #endif
-                    if(t_info->check_key){ // call the TART check Key! (casting from rec*)
-                        tid = checkKeyFromRec(tid, *keys_list->k);
+                    if(t_info.check_key){ // call the TART check Key! (casting from rec*)
+                        tid = checkKeyFromRec(tid, key);
                     }
                     if(tid!=0){ // oops, someone else inserted that key! Abort!
                         record* rec = reinterpret_cast<record*>(tid);
                         auto found_item = Sto::item(this, rec);
                         if(!rec->valid() && !has_insert(found_item)){
                             INCR(aborts[TThread::id()][4])
-                            delete t_info;
                             return false;
                         }
                         // add to read set
                         //found_item.observe(rec->version);
-                        delete t_info;
                         /*stringstream ss;
-                        ss<<TThread::id()<<": Abort! key " << keyToStr(*keys_list->k) <<endl;
+                        ss<<TThread::id()<<": Abort! key " << keyToStr(key) <<endl;
                         cout<<ss.str();*/
-                        clear_absent_keys_list(keys_list);
                         INCR(aborts[TThread::id()][9])
                         return false;
                     }
@@ -681,32 +927,37 @@ public:
                 i++;
                 keys_list = keys_list->next;
             }
-            clear_absent_keys_list(keys_list);
-            delete t_info;
             return true;
         }
         #elif ABSENT_VALIDATION == 4
         if(is_in_keyset(item)){
-            Key *k = get_key(item.key<uintptr_t>());
-            trans_info_t* t_info = new trans_info_t();
-            memset(t_info, 0, sizeof(trans_info_t));
+            Key k;
+            get_key(item.key<uintptr_t>())->load(k);
+            trans_info_t t_info;
+            memset(&t_info, 0, sizeof(trans_info_t));
             auto t = this->getThreadInfo();
-            TID tid = lookup(*k, t, t_info);
-            if(t_info->check_key){ // call the TART check Key! (casting from rec*)
-                tid = checkKeyFromRec(tid, *k);
+            TID tid = lookup(k, t, &t_info);
+            if(t_info.check_key){ // call the TART check Key! (casting from rec*)
+                tid = checkKeyFromRec(tid, k);
             }
-            delete t_info;
             if(tid !=0){ // oops, previously absent key exists now! Did we add it?
                 record* rec = reinterpret_cast<record*>(tid);
                 if(rec->valid() ) { // a concurrent transaction added that key! If it was the current transaction, valid 
                                     // bit would be false since check phase is before install.
-                    delete k;
                     INCR(aborts[TThread::id()][9])
                     //cout<<"Absent node found!\n";
                     return false;
                 }
             }
-            delete k;
+            return true;
+        }
+        #elif ABSENT_VALIDATION == 5
+        if(is_in_rangeset(item)){
+            if(!rs_check(get_range(item.key<uintptr_t>()))){
+                PRINT_DEBUG_VALIDATION("VALIDATION FAILED: RANGESET\n");
+                INCR(aborts[TThread::id()][10])
+                return false;
+            }
             return true;
         }
         #endif
@@ -730,6 +981,8 @@ public:
         assert(!is_in_nodeset(item));
         #elif ABSENT_VALIDATION == 4
         assert(!is_in_keyset(item));
+        #elif ABSENT_VALIDATION == 5
+        assert(!is_in_rangeset(item));
         #endif
 		record* rec = item.key<record*>();
 		//PRINT_DEBUG("Key: %s\n", keyToStr(rec->key).c_str())
@@ -766,6 +1019,8 @@ public:
         assert(!is_in_nodeset(item));
         #elif ABSENT_VALIDATION == 4
         assert(!is_in_keyset(item));
+        #elif ABSENT_VALIDATION == 5
+        assert(!is_in_rangeset(item));
         #endif
 		record* rec = item.key<record*>();
 		rec->version.unlock();
@@ -778,6 +1033,8 @@ public:
         assert(!is_in_nodeset(item));
         #elif ABSENT_VALIDATION == 4
         assert(!is_in_keyset(item));
+        #elif ABSENT_VALIDATION == 5
+        assert(!is_in_rangeset(item));
         #endif
 		record* rec = item.key<record*>();
 		Key k;
@@ -786,13 +1043,12 @@ public:
 		ThreadInfo epocheInfo = getThreadInfo();
 		if(committed? has_delete(item) : has_insert(item)){
 			// We check the result of remove (if not found)! Even though we check it earlier in t_remove, it might have been removed later. That's by using the 'shouldAbort' flag
-            trans_info_t* t_info = new trans_info_t();
-            bzero(t_info, sizeof(trans_info_t));
-            remove(k, tid, epocheInfo, t_info);
+            trans_info_t t_info;
+            bzero(&t_info, sizeof(trans_info_t));
+            remove(k, tid, epocheInfo, &t_info);
 			// Do not call RCU delete when element was actually not deleted (not found). We're ussing the shouldAbort field so that to not include an extra field for 'deleted'
-			if(!t_info->shouldAbort)
+			if(!t_info.shouldAbort)
                 Transaction::rcu_delete(rec);
-            delete t_info;
         }
 		item.clear_needs_unlock();
     }
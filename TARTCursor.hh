@@ -0,0 +1,305 @@
+#pragma once
+
+#include "OptimisticLockCoupling/Tree.h"
+#include "Key.h"
+#include <cstring>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+/*
+ *    Range cursor shared by TART.hh and TART-bloom.hh
+ *    ------------------------------------------------
+ *    Include it from a TART header after ABSENT_VALIDATION, aborts[] and
+ *    INCR are defined. The TART class makes tart_cursor<TART> a friend:
+ *    the cursor uses its record type, root_node(), has_insert/has_delete
+ *    and, per mode, ns_add_node (1) or the range set helpers (5).
+ */
+
+// A transactional range cursor: yields the records with keys in
+// [start, end) one at a time, in key order or (reverse) in descending
+// order. It descends from the root once and keeps a stack of node
+// snapshots, so a scan needs no result buffer and no restarts. Each
+// inner node is added to the node set when it is first visited and
+// each yielded or skipped record is observed, so phantoms in the
+// scanned part of the range are caught at commit (ABSENT_VALIDATION 1).
+// Under ABSENT_VALIDATION 5 the nodes are not tracked; instead the
+// part of the range scanned so far is kept as one range set entry.
+// Modes 2-4 have no range protection, as with t_lookupRange. The
+// first `offset` records in range are observed but not yielded, and
+// the scan stops after `limit` records without visiting the rest of
+// the range.
+//
+// The node snapshots are only safe to follow while the nodes cannot
+// be freed, so the cursor holds `ti`'s ART epoch for its whole
+// lifetime: `ti` must outlive it. Other operations on this tree by
+// the same thread re-enter that epoch and drop the protection, so a
+// thread must not use the tree while it has a cursor open.
+template <typename TART>
+class tart_cursor {
+public:
+    typedef typename TART::record record;
+
+    tart_cursor(TART& tart, const Key& start, const Key& end, ThreadInfo& ti, bool reverse,
+                std::size_t offset, std::size_t limit)
+        : tart_(tart), epoche_guard_(new EpocheGuard(ti)), reverse_(reverse), validating_(false),
+          offset_(offset), limit_(limit), nyielded_(0), aborted_(false), rec_(nullptr) {
+        start_.set((const char*)&start[0], start.getKeyLen());
+        end_.set((const char*)&end[0], end.getKeyLen());
+        #if ABSENT_VALIDATION == 5
+        // nothing scanned yet: [start, start), or [end, end) in reverse
+        range_ = tart_.rs_add_range(reverse ? end_ : start_, reverse ? end_ : start_, 0, 0);
+        pend_count_ = pend_fp_ = 0;
+        #endif
+        stack_.reserve(8);
+        push(tart_.root_node(), 0, true, true);
+    }
+
+    // Moves to the next record. Returns false at the end of the scan,
+    // or if the transaction must abort (then aborted() is true).
+    bool next(){
+        rec_ = nullptr;
+        #if ABSENT_VALIDATION == 5
+        if(!validating_ && !aborted_ && stack_.empty())
+            extend_range(false);
+        #endif
+        while(!aborted_ && !stack_.empty() && nyielded_ != limit_){
+            frame& f = stack_.back();
+            if(f.pos == f.nchildren){
+                stack_.pop_back();
+                continue;
+            }
+            uint32_t i = reverse_ ? f.nchildren - 1 - f.pos : f.pos;
+            ++f.pos;
+            uint8_t slice = std::get<0>(f.children[i]);
+            N* child = std::get<1>(f.children[i]);
+            bool lo_tight = f.lo_tight && slice == f.lo;
+            bool hi_tight = f.hi_tight && slice == f.hi;
+            if(!N::isLeaf(child)){
+                push(child, f.child_depth, lo_tight, hi_tight);
+                continue;
+            }
+            TID tid = N::getLeaf(child);
+            if((lo_tight || hi_tight) && !leaf_in_range(tid, lo_tight, hi_tight))
+                continue;
+            record* rec = reinterpret_cast<record*>(tid);
+            if(validating_){
+                // committed records only; a record locked by another
+                // committing transaction may be about to change
+                if(TransactionTid::is_locked_elsewhere(rec->version.value())){
+                    aborted_ = true;
+                    break;
+                }
+                if(!rec->valid() || rec->deleted)
+                    continue;
+                rec_ = rec;
+                return true;
+            }
+            auto item = Sto::item(&tart_, rec);
+            if(!rec->valid() && !TART::has_insert(item)){ // poisoned by a concurrent insert
+                INCR(aborts[TThread::id()][4])
+                aborted_ = true;
+                break;
+            }
+            #if ABSENT_VALIDATION == 5
+            if(rec->valid() && !rec->deleted){
+                ++pend_count_;
+                pend_fp_ ^= TART::rs_fingerprint(rec);
+            }
+            #endif
+            if(TART::has_delete(item)) // deleted by this transaction
+                continue;
+            item.observe(rec->version);
+            if(rec->deleted) // delete committed, not yet unlinked
+                continue;
+            if(offset_){
+                --offset_;
+                continue;
+            }
+            ++nyielded_;
+            rec_ = rec;
+            #if ABSENT_VALIDATION == 5
+            extend_range(true);
+            #endif
+            return true;
+        }
+        #if ABSENT_VALIDATION == 5
+        if(!validating_ && !aborted_ && stack_.empty())
+            extend_range(false);
+        #endif
+        return false;
+    }
+
+    bool aborted() const {
+        return aborted_;
+    }
+    // the current record's value
+    TID value() const {
+        return rec_->val;
+    }
+    void load_key(Key& k) const {
+        tart_.loadKey(reinterpret_cast<TID>(rec_), k);
+    }
+
+private:
+    struct frame {
+        uint32_t child_depth;       // key depth below this node
+        bool lo_tight, hi_tight;    // path so far equals start_/end_
+        uint8_t lo, hi;             // child keyslice bounds
+        uint32_t nchildren, pos;
+        std::tuple<uint8_t, N*> children[256];
+    };
+
+    TART& tart_;
+    // movable, so the cursor can be returned by t_scan
+    std::unique_ptr<EpocheGuard> epoche_guard_;
+    Key start_, end_;
+    bool reverse_;
+    bool validating_;
+    std::size_t offset_, limit_, nyielded_;
+    bool aborted_;
+    record* rec_;
+    std::vector<frame> stack_;
+    #if ABSENT_VALIDATION == 5
+    typedef typename TART::key_range key_range;
+
+    key_range* range_;
+    // committed records visited since range_ was last extended
+    uint64_t pend_count_, pend_fp_;
+
+    // A plain forward scan of committed records in [start, end), for
+    // range set validation: no read set, no range set.
+    tart_cursor(TART& tart, const Key& start, const Key& end, ThreadInfo& ti)
+        : tart_(tart), epoche_guard_(new EpocheGuard(ti)), reverse_(false), validating_(true),
+          offset_(0), limit_(SIZE_MAX), nyielded_(0), aborted_(false), rec_(nullptr) {
+        start_.set((const char*)&start[0], start.getKeyLen());
+        end_.set((const char*)&end[0], end.getKeyLen());
+        stack_.reserve(8);
+        push(tart_.root_node(), 0, true, true);
+    }
+
+    // Grows the range set entry to cover the records visited so far:
+    // up to and including the current record, or the whole range
+    // once the scan is over.
+    void extend_range(bool at_current){
+        if(at_current){
+            Key k;
+            load_key(k);
+            if(reverse_)
+                range_->lo.assign(k);
+            else {
+                Key succ;
+                TART::key_successor(k, succ);
+                range_->hi.assign(succ);
+            }
+        } else if(reverse_)
+            range_->lo.assign(start_);
+        else
+            range_->hi.assign(end_);
+        range_->count += pend_count_;
+        range_->fp ^= pend_fp_;
+        pend_count_ = pend_fp_ = 0;
+    }
+
+    friend TART;
+    #endif
+
+    // compares node prefix or key bytes [depth, depth+len) with `bound`:
+    // <0 if they sort before it, >0 after, 0 if `bound` continues them
+    static int compare_bytes(const uint8_t* bytes, uint32_t depth, uint32_t len, const Key& bound){
+        for(uint32_t i = 0; i < len; i++){
+            if(depth + i >= bound.getKeyLen())
+                return 1;
+            if(bytes[i] != bound[depth + i])
+                return bytes[i] < bound[depth + i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    bool leaf_in_range(TID tid, bool lo_tight, bool hi_tight){
+        Key k;
+        tart_.loadKey(tid, k);
+        if(lo_tight && compare_keys(k, start_) < 0)
+            return false;
+        if(hi_tight && compare_keys(k, end_) >= 0)
+            return false;
+        return true;
+    }
+
+    static int compare_keys(const Key& a, const Key& b){
+        uint32_t la = a.getKeyLen(), lb = b.getKeyLen();
+        int cmp = memcmp(&a[0], &b[0], std::min(la, lb));
+        if(cmp == 0)
+            cmp = la < lb ? -1 : (la > lb ? 1 : 0);
+        return cmp;
+    }
+
+    // Snapshots node `n`'s children that may hold keys in range and
+    // adds it to the node set. A node that changes under us is a
+    // conflict with a concurrent writer: abort rather than restart.
+    void push(N* n, uint32_t depth, bool lo_tight, bool hi_tight){
+        bool needRestart = false;
+        uint64_t v = n->readLockOrRestart(needRestart);
+        if(needRestart){
+            aborted_ = true;
+            return;
+        }
+        // the node's compressed prefix; only the first
+        // maxStoredPrefixLength bytes are stored in the node
+        uint32_t plen = n->getPrefixLength();
+        uint8_t prefix_buf[maxStoredPrefixLength];
+        const uint8_t* prefix = n->getPrefix();
+        Key any_key;
+        if(plen > maxStoredPrefixLength && (lo_tight || hi_tight)){
+            TID any = N::getAnyChildTid(n, needRestart);
+            if(needRestart){
+                aborted_ = true;
+                return;
+            }
+            tart_.loadKey(any, any_key);
+            prefix = &any_key[depth];
+        } else if(plen > maxStoredPrefixLength)
+            plen = 0; // prefix bytes only matter for tight bounds
+        else {
+            memcpy(prefix_buf, prefix, plen);
+            prefix = prefix_buf;
+        }
+
+        stack_.emplace_back();
+        frame& f = stack_.back();
+        f.child_depth = depth + n->getPrefixLength() + 1;
+        f.nchildren = f.pos = 0;
+        f.lo = 0;
+        f.hi = 255;
+        f.lo_tight = f.hi_tight = false;
+        bool empty = false;
+        if(lo_tight){
+            int cmp = compare_bytes(prefix, depth, plen, start_);
+            if(cmp < 0)
+                empty = true;
+            else if(cmp == 0 && f.child_depth - 1 < start_.getKeyLen()){
+                f.lo = start_[f.child_depth - 1];
+                f.lo_tight = true;
+            }
+        }
+        if(hi_tight && !empty){
+            int cmp = compare_bytes(prefix, depth, plen, end_);
+            if(cmp > 0 || (cmp == 0 && f.child_depth - 1 >= end_.getKeyLen()))
+                empty = true;
+            else if(cmp == 0){
+                f.hi = end_[f.child_depth - 1];
+                f.hi_tight = true;
+            }
+        }
+        if(!empty && f.lo <= f.hi)
+            N::getChildren(n, f.lo, f.hi, f.children, f.nchildren);
+        n->readUnlockOrRestart(v, needRestart);
+        if(needRestart){
+            aborted_ = true;
+            return;
+        }
+        #if ABSENT_VALIDATION == 1
+        tart_.ns_add_node(n, v);
+        #endif
+    }
+};
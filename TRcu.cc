@@ -1,7 +1,8 @@
 #include "TRcu.hh"
 
 TRcuSet::TRcuSet()
-    : clean_epoch_(0) {
+    : clean_epoch_(0), npending_(0), bytes_pending_(0), nreclaimed_(0),
+      npstats_(0) {
     unsigned capacity = (4080 - sizeof(TRcuGroup)) / sizeof(TRcuGroup::TRcuElement);
     current_ = first_ = TRcuGroup::make(capacity);
     // ngroups_ = 1;
@@ -64,7 +65,23 @@ inline bool TRcuGroup::clean_until(epoch_type max_epoch) {
         return false;
 }
 
+void TRcuSet::account_clean(epoch_type max_epoch) {
+    unsigned i = 0;
+    while (i != npstats_ && signed_epoch_type(max_epoch - pstats_[i].epoch) > 0) {
+        npending_ -= pstats_[i].n;
+        bytes_pending_ -= pstats_[i].bytes;
+        nreclaimed_ += pstats_[i].n;
+        ++i;
+    }
+    if (i) {
+        for (unsigned j = i; j != npstats_; ++j)
+            pstats_[j - i] = pstats_[j];
+        npstats_ -= i;
+    }
+}
+
 void TRcuSet::hard_clean_until(epoch_type max_epoch) {
+    account_clean(max_epoch);
     TRcuGroup* empty_head = nullptr;
     TRcuGroup* empty_tail = nullptr;
     // clean [first_, current_]
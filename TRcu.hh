@@ -69,10 +69,12 @@ public:
     TRcuSet();
     ~TRcuSet();
 
-    void add(epoch_type epoch, void (*function)(void*), void* argument) {
+    void add(epoch_type epoch, void (*function)(void*), void* argument,
+             size_t size = 0) {
         if (unlikely(current_->tail_ + 2 > current_->capacity_))
             grow();
         current_->add(epoch, function, argument);
+        account(epoch, size);
     }
     void clean_until(epoch_type max_epoch) {
         if (clean_epoch_ != max_epoch)
@@ -83,10 +85,43 @@ public:
         return clean_epoch_;
     }
 
+    // reclamation accounting (read racily by other threads for stats)
+    size_t npending() const {
+        return npending_;
+    }
+    size_t bytes_pending() const {
+        return bytes_pending_;
+    }
+    size_t nreclaimed() const {
+        return nreclaimed_;
+    }
+    // epoch of the oldest object not yet reclaimed; false if none
+    bool oldest_pending_epoch(epoch_type& epoch) const {
+        if (!npstats_)
+            return false;
+        epoch = pstats_[0].epoch;
+        return true;
+    }
+
 private:
+    // pending objects per registration epoch, oldest first. When full,
+    // newer epochs fold into the last entry, which then releases late
+    // (the counts overestimate, never underestimate, what is pending).
+    struct epoch_stats {
+        epoch_type epoch;
+        size_t n;
+        size_t bytes;
+    };
+    static constexpr unsigned max_pstats = 8;
+
     TRcuGroup* current_;
     TRcuGroup* first_;
     epoch_type clean_epoch_;
+    size_t npending_;
+    size_t bytes_pending_;
+    size_t nreclaimed_;
+    unsigned npstats_;
+    epoch_stats pstats_[max_pstats];
     // unsigned ngroups_;
 
     TRcuSet(const TRcuSet&) = delete;
@@ -94,4 +129,18 @@ private:
     void check();
     void grow();
     void hard_clean_until(epoch_type max_epoch);
+
+    void account(epoch_type epoch, size_t size) {
+        if (!npstats_ || pstats_[npstats_ - 1].epoch != epoch) {
+            if (npstats_ == max_pstats)
+                pstats_[npstats_ - 1].epoch = epoch;
+            else
+                pstats_[npstats_++] = epoch_stats{epoch, 0, 0};
+        }
+        ++pstats_[npstats_ - 1].n;
+        pstats_[npstats_ - 1].bytes += size;
+        ++npending_;
+        bytes_pending_ += size;
+    }
+    void account_clean(epoch_type max_epoch);
 };
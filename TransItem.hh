@@ -210,8 +210,10 @@ private:
 
 class TransProxy {
   public:
-    TransProxy(Transaction& t, TransItem& item)
-        : t_(&t), item_(&item) {
+    static constexpr unsigned unknown_index = ~0U;
+
+    TransProxy(Transaction& t, TransItem& item, unsigned tidx = unknown_index)
+        : t_(&t), item_(&item), tidx_(tidx) {
         assert(&t == TThread::txn);
     }
 
@@ -382,6 +384,7 @@ class TransProxy {
 private:
     Transaction* t_;
     TransItem* item_;
+    unsigned tidx_; // item's tset index, if the proxy came from a lookup
     inline Transaction* t() const {
         return t_;
     }
@@ -398,7 +401,7 @@ class OptionalTransProxy {
     }
     TransProxy get() const {
         assert(item_);
-        return TransProxy(*t(), *item_);
+        return TransProxy(*t(), *item_, tidx_);
     }
     TransProxy operator*() const {
         return get();
@@ -408,8 +411,9 @@ class OptionalTransProxy {
     }
   private:
     TransItem* item_;
-    OptionalTransProxy(Transaction& t, TransItem* item)
-        : item_(item) {
+    unsigned tidx_;
+    OptionalTransProxy(Transaction& t, TransItem* item, unsigned tidx)
+        : item_(item), tidx_(tidx) {
         (void) t;
         assert(&t == TThread::txn);
     }
@@ -1,11 +1,27 @@
 #include "Transaction.hh"
 #include <typeinfo>
+#include <new>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
 
 Transaction::testing_type Transaction::testing;
-threadinfo_t Transaction::tinfo[MAX_THREADS];
+threadinfo_registry Transaction::tinfo;
 __thread int TThread::the_id;
+__thread int TThread::the_lock_id;
 Transaction::epoch_state __attribute__((aligned(128))) Transaction::global_epochs = {
-    1, 0, TransactionTid::increment_value, true
+    1, 0, TransactionTid::increment_value, true, 0, 0, 0, 0
+};
+Transaction::epoch_config_type Transaction::epoch_config = {
+    100000, 1000, 1 << 16, false
+};
+Transaction::validation_config_type Transaction::validation_config = {
+    0, 65536, MAX_THREADS - 16
+};
+Transaction::cm_config_type Transaction::cm_config = {
+    STO_CM_POLICY, 7, 20, 1 << 16
 };
 __thread Transaction *TThread::txn = nullptr;
 std::function<void(threadinfo_t::epoch_type)> Transaction::epoch_advance_callback;
@@ -14,34 +30,239 @@ TransactionTid::type __attribute__((aligned(128))) Transaction::_TID = 2 * Trans
 
 static void __attribute__((used)) check_static_assertions() {
     static_assert(sizeof(threadinfo_t) % 128 == 0, "threadinfo is 2-cache-line aligned");
+    static_assert(MAX_THREADS <= TransactionTid::max_threads, "MAX_THREADS does not fit in TransactionTid::threadid_mask");
+}
+
+threadinfo_t* threadinfo_registry::hard_register(int i) {
+    assert(i >= 0 && i < MAX_THREADS);
+    void* x;
+    if (posix_memalign(&x, alignof(threadinfo_t), sizeof(threadinfo_t)) != 0)
+        throw std::bad_alloc();
+    threadinfo_t* ti = new(x) threadinfo_t;
+    if (!bool_cmpxchg(&ti_[i], (threadinfo_t*) nullptr, ti)) {
+        // lost a race registering this id
+        ti->~threadinfo_t();
+        ::free(x);
+        return ti_[i];
+    }
+    int l;
+    while ((l = limit_) <= i && !bool_cmpxchg(&limit_, l, i + 1))
+        relax_fence();
+    return ti;
+}
+
+void abort_table::account(const TObject* owner, uint64_t bucket, const char* reason) {
+    if (unlikely(!e_)) {
+        entry* e = new entry[capacity];
+        for (unsigned i = 0; i != capacity; ++i)
+            e[i].seq = 0, e[i].owner = nullptr, e[i].reason = nullptr, e[i].count = e[i].error = 0;
+        release_fence();
+        e_ = e;
+    }
+    if (unlikely(cleared_ != clear_requested_)) {
+        unsigned req = clear_requested_;
+        acquire_fence();
+        for (unsigned i = 0; i != capacity; ++i)
+            if (e_[i].reason) {
+                ++e_[i].seq;
+                release_fence();
+                e_[i].reason = nullptr;
+                e_[i].count = e_[i].error = 0;
+                release_fence();
+                ++e_[i].seq;
+            }
+        nevicted_ = 0;
+        release_fence();
+        cleared_ = req;
+    }
+    uint64_t h = (reinterpret_cast<uintptr_t>(owner) >> 4)
+        ^ (bucket * 0x9E3779B97F4A7C15ULL)
+        ^ (reinterpret_cast<uintptr_t>(reason) >> 3);
+    h ^= h >> 29;
+    entry* victim = nullptr;
+    for (unsigned n = 0; n != window; ++n) {
+        entry& x = e_[(h + n) % capacity];
+        if (!x.reason) {
+            victim = &x;
+            break;
+        } else if (x.reason == reason && x.owner == owner && x.bucket == bucket) {
+            ++x.count;
+            return;
+        } else if (!victim || x.count < victim->count)
+            victim = &x;
+    }
+    uint64_t inherited = victim->reason ? victim->count : 0;
+    if (victim->reason)
+        ++nevicted_;
+    ++victim->seq;
+    release_fence();
+    victim->owner = owner;
+    victim->type = owner ? typeid(*owner).name() : nullptr;
+    victim->bucket = bucket;
+    victim->reason = reason;
+    victim->count = inherited + 1;
+    victim->error = inherited;
+    release_fence();
+    ++victim->seq;
 }
 
 void Transaction::initialize() {
     static_assert(tset_initial_capacity % tset_chunk == 0, "tset_initial_capacity not an even multiple of tset_chunk");
-    hash_base_ = 32768;
     tset_size_ = 0;
+    cm_attempt_ = 0;
+#if TRANSACTION_HASHTABLE
+    static_assert((hash_size & (hash_size - 1)) == 0, "hash_size not a power of 2");
+    hash_base_ = hash_base_limit; // start() clears the index
+    hash_shift_ = 64 - __builtin_ctz(hash_size);
+    hash_mask_ = hash_size - 1;
+    hashtable_ = hashtable0_;
+#endif
     lrng_state_ = 12897;
+    tset_ = tset_dir0_;
+    tset_nchunks_ = tset_initial_nchunks;
+    tset_nallocated_ = 0;
     for (unsigned i = 0; i != tset_initial_capacity / tset_chunk; ++i)
         tset_[i] = &tset0_[i * tset_chunk];
-    for (unsigned i = tset_initial_capacity / tset_chunk; i != arraysize(tset_); ++i)
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_nchunks_; ++i)
         tset_[i] = nullptr;
+    wset_ = wset0_;
+    wset_size_ = 0;
+    wset_capacity_ = wset_initial_capacity;
 }
 
 Transaction::~Transaction() {
     if (in_progress())
         silent_abort();
-    TransItem* live = tset0_;
-    for (unsigned i = 0; i != arraysize(tset_); ++i, live += tset_chunk)
-        if (live != tset_[i])
-            delete[] tset_[i];
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_nchunks_; ++i)
+        delete[] tset_[i];
+    if (tset_ != tset_dir0_)
+        delete[] tset_;
+    if (wset_ != wset0_)
+        delete[] wset_;
+#if TRANSACTION_HASHTABLE
+    if (hashtable_ != hashtable0_)
+        delete[] hashtable_;
+#endif
 }
 
+#if TRANSACTION_HASHTABLE
+void Transaction::grow_hashtable() {
+    unsigned capacity = 2 * (hash_mask_ + 1);
+    uint32_t* h = new uint32_t[capacity]();
+    if (hashtable_ != hashtable0_)
+        delete[] hashtable_;
+    hashtable_ = h;
+    hash_mask_ = capacity - 1;
+    --hash_shift_;
+    const TransItem* it = nullptr;
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+        unsigned hi = hash(it->owner(), it->key_);
+        while (h[hi] > hash_base_)
+            hi = (hi + 1) & hash_mask_;
+        h[hi] = hash_base_ + tidx + 1;
+    }
+}
+#endif
+
 void Transaction::refresh_tset_chunk() {
     assert(tset_size_ % tset_chunk == 0);
-    assert(tset_size_ < tset_max_capacity);
-    if (!tset_[tset_size_ / tset_chunk])
-        tset_[tset_size_ / tset_chunk] = new TransItem[tset_chunk];
-    tset_next_ = tset_[tset_size_ / tset_chunk];
+    unsigned ci = tset_size_ / tset_chunk;
+    // keep tset_[tset_size_ / tset_chunk] addressable when this chunk fills
+    if (ci + 1 >= tset_nchunks_)
+        grow_tset_directory();
+    if (!tset_[ci]) {
+        tset_[ci] = new TransItem[tset_chunk];
+        ++tset_nallocated_;
+    }
+    tset_next_ = tset_[ci];
+}
+
+void Transaction::grow_tset_directory() {
+    unsigned n = 2 * tset_nchunks_;
+    TransItem** dir = new TransItem*[n];
+    std::copy(tset_, tset_ + tset_nchunks_, dir);
+    std::fill(dir + tset_nchunks_, dir + n, nullptr);
+    if (tset_ != tset_dir0_)
+        delete[] tset_;
+    tset_ = dir;
+    tset_nchunks_ = n;
+}
+
+unsigned Transaction::hard_tset_index(const TransItem* it) const {
+    for (unsigned ci = tset_initial_capacity / tset_chunk; ci * tset_chunk < tset_size_; ++ci)
+        if (it >= tset_[ci] && it < tset_[ci] + tset_chunk)
+            return ci * tset_chunk + (it - tset_[ci]);
+    always_assert(false && "item not in tset");
+    return 0;
+}
+
+void Transaction::grow_wset() {
+    unsigned* w = new unsigned[2 * wset_capacity_];
+    std::copy(wset_, wset_ + wset_size_, w);
+    if (wset_ != wset0_)
+        delete[] wset_;
+    wset_ = w;
+    wset_capacity_ *= 2;
+}
+
+void Transaction::trim_tset() {
+    // called between transactions: free chunks beyond the retained set
+    unsigned keep = tset_initial_capacity / tset_chunk + tset_retained_nchunks;
+    for (unsigned i = keep; i < tset_nchunks_ && tset_[i]; ++i) {
+        delete[] tset_[i];
+        tset_[i] = nullptr;
+        --tset_nallocated_;
+    }
+}
+
+static inline uint64_t epoch_us_to_tsc(unsigned us) {
+    return uint64_t(us * PROC_TSC_FREQ * 1000);
+}
+
+// Advance the global epoch once. Any thread may call this; concurrent
+// callers back off rather than advancing twice. Returns true if this
+// call advanced the epoch.
+bool Transaction::advance_epoch(bool pressure) {
+    if (global_epochs.advancing
+        || !bool_cmpxchg(&global_epochs.advancing, 0, 1))
+        return false;
+    epoch_type g = global_epochs.global_epoch;
+    epoch_type e = g;
+    for (int i = 0; i != tinfo.limit(); ++i) {
+        threadinfo_t* t = tinfo.get(i);
+        if (t && t->epoch != 0 && signed_epoch_type(t->epoch - e) < 0)
+            e = t->epoch;
+    }
+    global_epochs.global_epoch = std::max(g + 1, epoch_type(1));
+    global_epochs.active_epoch = e;
+    global_epochs.recent_tid = Transaction::_TID;
+    global_epochs.advance_tsc = read_tsc();
+    ++global_epochs.nadvances;
+    if (pressure)
+        ++global_epochs.npressure_advances;
+
+    if (epoch_advance_callback)
+        epoch_advance_callback(global_epochs.global_epoch);
+    release_fence();
+    global_epochs.advancing = 0;
+    return true;
+}
+
+// Called from start() when this thread holds too much unreclaimed memory,
+// or in cooperative mode. Advances the epoch if it is due.
+void Transaction::epoch_maintenance(threadinfo_t& thr) {
+    uint64_t since = read_tsc() - global_epochs.advance_tsc;
+    bool pressure = epoch_config.rcu_threshold
+        && thr.rcu_set.npending() > epoch_config.rcu_threshold;
+    if ((pressure && since >= epoch_us_to_tsc(epoch_config.min_interval_us))
+        || (epoch_config.cooperative && since >= epoch_us_to_tsc(epoch_config.interval_us))) {
+        if (advance_epoch(pressure)) {
+            // nothing has been read yet, so moving to the new epoch is safe
+            thr.epoch = global_epochs.global_epoch;
+            thr.rcu_set.clean_until(global_epochs.active_epoch);
+        }
+    }
 }
 
 void* Transaction::epoch_advancer(void*) {
@@ -50,25 +271,100 @@ void* Transaction::epoch_advancer(void*) {
         std::cerr << "WARNING: more than one epoch_advancer thread\n";
 
     // don't bother epoch'ing til things have picked up
-    usleep(100000);
+    usleep(epoch_config.interval_us);
     while (global_epochs.run) {
-        epoch_type g = global_epochs.global_epoch;
-        epoch_type e = g;
-        for (auto& t : tinfo) {
-            if (t.epoch != 0 && signed_epoch_type(t.epoch - e) < 0)
-                e = t.epoch;
+        // threads under memory pressure advance on their own (see
+        // epoch_maintenance), so skip a tick if one just did
+        uint64_t since = read_tsc() - global_epochs.advance_tsc;
+        unsigned interval = epoch_config.interval_us;
+        if (since >= epoch_us_to_tsc(interval) / 2)
+            advance_epoch();
+        usleep(interval);
+    }
+    fetch_and_add(&num_epoch_advancers, -1);
+    return NULL;
+}
+
+Transaction::rcu_stats_type Transaction::rcu_stats() {
+    rcu_stats_type out = {0, 0, 0, 0};
+    epoch_type g = global_epochs.global_epoch;
+    for (int i = 0; i != tinfo.limit(); ++i)
+        if (threadinfo_t* t = tinfo.get(i)) {
+            out.npending += t->rcu_set.npending();
+            out.bytes_pending += t->rcu_set.bytes_pending();
+            out.nreclaimed += t->rcu_set.nreclaimed();
+            epoch_type e;
+            if (t->rcu_set.oldest_pending_epoch(e)
+                && signed_epoch_type(g - e) > signed_epoch_type(out.max_lag))
+                out.max_lag = g - e;
         }
-        global_epochs.global_epoch = std::max(g + 1, epoch_type(1));
-        global_epochs.active_epoch = e;
-        global_epochs.recent_tid = Transaction::_TID;
+    return out;
+}
+
+const char* Transaction::cm_policy_name(int policy) {
+    static const char* names[] = {"default", "expbackoff", "karma", "wait-die", "abort-on-locked"};
+    static_assert(arraysize(names) == cm_npolicies, "cm_policy names");
+    if (unsigned(policy) < arraysize(names))
+        return names[policy];
+    else
+        return "unknown-policy";
+}
 
-        if (epoch_advance_callback)
-            epoch_advance_callback(global_epochs.global_epoch);
+static inline void cm_pause(unsigned n) {
+    if (n > 3)
+        for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
+            relax_fence();
+    relax_fence();
+}
 
-        usleep(100000);
+// Called when try_lock() finds `v` locked for the nth time. Returns true
+// to try again, false to give up (and abort).
+bool Transaction::cm_wait(TransactionTid::type v, unsigned n) {
+    switch (cm_policy_) {
+    case cm_expbackoff:
+        if (n >= cm_config.spin_bound)
+            return false;
+        cm_pause(n);
+        return true;
+    case cm_karma:
+    case cm_wait_die: {
+        if (n >= cm_config.wait_bound)
+            return false;
+        if (v & TransactionTid::lock_bit) {
+            int owner = v & TransactionTid::threadid_mask;
+            threadinfo_t* o = tinfo.get(owner);
+            uint64_t mine = tinfo[threadid_].cm_priority;
+            if (o && (o->cm_priority > mine
+                      || (o->cm_priority == mine && owner < threadid_)))
+                return false;
+        }
+        cm_pause(n);
+        return true;
     }
-    fetch_and_add(&num_epoch_advancers, -1);
-    return NULL;
+    case cm_abort_on_locked:
+        return false;
+    default:
+#if STO_SPIN_EXPBACKOFF
+        if (n == STO_SPIN_BOUND_WRITE)
+            return false;
+        cm_pause(n);
+#else
+        if (n == (1 << STO_SPIN_BOUND_WRITE))
+            return false;
+        relax_fence();
+#endif
+        return true;
+    }
+}
+
+// Called by TransactionLoopGuard before retrying an aborted transaction.
+void Transaction::cm_backoff(unsigned attempt) {
+    cm_account(txp_cm_retries);
+    if (cm_policy_ == cm_default || cm_policy_ == cm_abort_on_locked)
+        return;
+    unsigned spins = std::min(1U << std::min(attempt, 24U), cm_config.backoff_max);
+    for (; spins; --spins)
+        relax_fence();
 }
 
 bool Transaction::preceding_duplicate_read(TransItem* needle) const {
@@ -121,13 +417,13 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
             TXP_INCREMENT(txp_total_check_read);
             if (!it->owner()->check(*it, *this)
                 && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
-                mark_abort_because(item, "opacity check");
+                mark_abort_because(it, "opacity check");
                 goto abort;
             }
         } else if (it->has_predicate()) {
             TXP_INCREMENT(txp_total_check_predicate);
             if (!it->owner()->check_predicate(*it, *this, false)) {
-                mark_abort_because(item, "opacity check_predicate");
+                mark_abort_because(it, "opacity check_predicate");
                 goto abort;
             }
         }
@@ -155,6 +451,14 @@ void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
             buf << '\n';
             std::cerr << buf.str();
         }
+#endif
+#if STO_ABORT_ATTRIBUTION
+        if (abort_item_)
+            tinfo[threadid_].aborts_.account(abort_item_->owner(),
+                                             abort_item_->owner()->abort_bucket(*abort_item_),
+                                             abort_reason_ ? abort_reason_ : "unknown");
+        else
+            tinfo[threadid_].aborts_.account(nullptr, 0, abort_reason_ ? abort_reason_ : "unattributed");
 #endif
     }
 
@@ -204,6 +508,8 @@ void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
 after_unlock:
     // TODO: this will probably mess up with nested transactions
     threadinfo_t& thr = tinfo[TThread::id()];
+    if (!committed)
+        thr.cm_karma += tset_size_;
     if (thr.trans_end_callback)
         thr.trans_end_callback();
     // XXX should reset trans_end_callback after calling it...
@@ -216,6 +522,175 @@ after_unlock:
 #endif
 }
 
+// One parallel validation runs at a time. Helpers keep their own thread ids,
+// so per-thread state (threadinfo, arenas, counters) is never shared with
+// the committer. They get the committing transaction from the job and pass
+// it to check(); only lock ownership is judged as the committer's.
+struct Transaction::validation_job {
+    Transaction* txn;
+    int threadid;
+    unsigned nblocks;
+    unsigned next_block;
+    unsigned nchecked;
+    int nrunning;
+    volatile bool failed;
+    TransItem* failed_item;
+
+    static pthread_mutex_t mutex;
+    static pthread_cond_t cond;
+    static validation_job* current;
+    static uint64_t generation;
+    static unsigned nhelpers;
+    static int busy;
+};
+
+pthread_mutex_t Transaction::validation_job::mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Transaction::validation_job::cond = PTHREAD_COND_INITIALIZER;
+Transaction::validation_job* Transaction::validation_job::current;
+uint64_t Transaction::validation_job::generation;
+unsigned Transaction::validation_job::nhelpers;
+int Transaction::validation_job::busy;
+
+struct Transaction::validation_helper_args {
+    uint64_t seen;
+    int threadid;
+};
+
+void* Transaction::validation_helper(void* arg) {
+    auto args = reinterpret_cast<validation_helper_args*>(arg);
+    uint64_t seen = args->seen;
+    int threadid = args->threadid;
+    delete args;
+    TThread::set_id(threadid);
+    pthread_mutex_lock(&validation_job::mutex);
+    while (1) {
+        while (validation_job::generation == seen)
+            pthread_cond_wait(&validation_job::cond, &validation_job::mutex);
+        seen = validation_job::generation;
+        validation_job* job = validation_job::current;
+        pthread_mutex_unlock(&validation_job::mutex);
+
+        // locks the committer holds on its write set count as ours
+        TThread::set_lock_id(job->threadid);
+        job->txn->check_read_blocks(*job);
+        TThread::set_lock_id(threadid);
+        fetch_and_add(&job->nrunning, -1);
+
+        pthread_mutex_lock(&validation_job::mutex);
+    }
+    return nullptr;
+}
+
+void Transaction::check_read_blocks(validation_job& job) {
+    unsigned nchecked = 0;
+    unsigned b;
+    TransItem* it = nullptr;
+    try {
+        while (!job.failed
+               && (b = fetch_and_add(&job.next_block, 1U)) < job.nblocks) {
+            unsigned end = std::min((b + 1) * validation_block, tset_size_);
+            for (unsigned tidx = b * validation_block; tidx != end && !job.failed; ++tidx) {
+                it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+                if (it->has_read()) {
+                    ++nchecked;
+                    if (!it->owner()->check(*it, *this)
+                        && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
+                        job.failed_item = it;
+                        job.failed = true;
+                    }
+                }
+            }
+        }
+    } catch (...) {
+        job.failed_item = it;
+        job.failed = true;
+    }
+    fetch_and_add(&job.nchecked, nchecked);
+}
+
+// Returns 1 if all reads validate, 0 if one fails, -1 if the pool is busy.
+int Transaction::check_reads_parallel() {
+    static_assert(validation_block % tset_chunk == 0, "validation_block not a multiple of tset_chunk");
+    if (validation_job::busy || !bool_cmpxchg(&validation_job::busy, 0, 1))
+        return -1;
+    while (validation_job::nhelpers < validation_config.nhelpers
+           && validation_config.first_threadid + int(validation_job::nhelpers) < MAX_THREADS) {
+        pthread_t helper;
+        auto arg = new validation_helper_args{validation_job::generation,
+                                              validation_config.first_threadid + int(validation_job::nhelpers)};
+        assert(arg->threadid >= 0);
+        if (pthread_create(&helper, nullptr, validation_helper, arg) != 0) {
+            delete arg;
+            break;
+        }
+        pthread_detach(helper);
+        ++validation_job::nhelpers;
+    }
+
+    validation_job job;
+    job.txn = this;
+    job.threadid = threadid_;
+    job.nblocks = (tset_size_ + validation_block - 1) / validation_block;
+    job.next_block = job.nchecked = 0;
+    job.nrunning = validation_job::nhelpers;
+    job.failed = false;
+    job.failed_item = nullptr;
+
+    pthread_mutex_lock(&validation_job::mutex);
+    validation_job::current = &job;
+    ++validation_job::generation;
+    pthread_cond_broadcast(&validation_job::cond);
+    pthread_mutex_unlock(&validation_job::mutex);
+
+    check_read_blocks(job);
+    while (*(volatile int*) &job.nrunning)
+        relax_fence();
+    fence();
+    validation_job::busy = 0;
+
+    TXP_ACCOUNT(txp_total_r, job.nchecked);
+    TXP_ACCOUNT(txp_total_check_read, job.nchecked);
+    if (job.failed) {
+        mark_abort_because(job.failed_item, "commit check");
+        return 0;
+    }
+    return 1;
+}
+
+bool Transaction::check_reads() {
+    if (validation_config.nhelpers && tset_size_ >= validation_config.min_tset) {
+        int r = check_reads_parallel();
+        if (r >= 0)
+            return r;
+    }
+    TransItem* it = nullptr;
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+        if (it->has_read()) {
+            TXP_INCREMENT(txp_total_r);
+            TXP_INCREMENT(txp_total_check_read);
+            if (!it->owner()->check(*it, *this)
+                && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
+                mark_abort_because(it, "commit check");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#if STO_LATENCY_HISTOGRAMS
+static inline tc_counter_type latency_mark(latency_histograms& lh, int phase,
+                                           tc_counter_type since) {
+    tc_counter_type now = read_tsc();
+    lh.h_[phase].add(now - since);
+    return now;
+}
+#define LATENCY_MARK(phase) lh_tsc = latency_mark(lh, (phase), lh_tsc)
+#else
+#define LATENCY_MARK(phase) do { } while (0)
+#endif
+
 bool Transaction::try_commit() {
 #if STO_TSC_PROFILE
     TimeKeeper<tc_commit> tk;
@@ -235,6 +710,12 @@ bool Transaction::try_commit() {
     if (state_ >= s_aborted)
         return state_ > s_aborted;
 
+#if STO_LATENCY_HISTOGRAMS
+    latency_histograms& lh = tinfo[threadid_].lh_;
+    tc_counter_type lh_tsc = start_tsc_;
+#endif
+    LATENCY_MARK(lh_exec);
+
     if (any_nonopaque_)
         TXP_INCREMENT(txp_commit_time_nonopaque);
 #if !CONSISTENCY_CHECK
@@ -247,63 +728,61 @@ bool Transaction::try_commit() {
 
     state_ = s_committing;
 
-    unsigned writeset[tset_size_];
+    // writes were recorded by add_write(); put them in tset order and drop
+    // cleared and repeated entries
+    if (!wset_sorted_)
+        std::sort(wset_, wset_ + wset_size_);
+    unsigned* writeset = wset_;
     unsigned nwriteset = 0;
-    writeset[0] = tset_size_;
+    for (unsigned i = 0; i != wset_size_; ++i) {
+        unsigned tidx = wset_[i];
+        if ((!nwriteset || writeset[nwriteset - 1] != tidx)
+            && tset_item(tidx)->has_write())
+            writeset[nwriteset++] = tidx;
+    }
+    first_write_ = nwriteset ? writeset[0] : tset_size_;
 
     TransItem* it = nullptr;
-    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
-        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
-        if (it->has_write()) {
-            writeset[nwriteset++] = tidx;
-#if !STO_SORT_WRITESET
-            if (nwriteset == 1) {
-                first_write_ = writeset[0];
-                state_ = s_committing_locked;
-            }
-            if (!it->owner()->lock(*it, *this)) {
-                mark_abort_because(it, "commit lock");
-                goto abort;
-            }
-            it->__or_flags(TransItem::lock_bit);
-#endif
-        }
-        if (it->has_read())
-            TXP_INCREMENT(txp_total_r);
-        else if (it->has_predicate()) {
-            TXP_INCREMENT(txp_total_check_predicate);
-            if (!it->owner()->check_predicate(*it, *this, true)) {
-                mark_abort_because(it, "commit check_predicate");
-                goto abort;
+    if (any_predicates_) {
+        for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
+            it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+            if (it->has_predicate() && !it->has_read()) {
+                TXP_INCREMENT(txp_total_check_predicate);
+                if (!it->owner()->check_predicate(*it, *this, true)) {
+                    mark_abort_because(it, "commit check_predicate");
+                    goto abort;
+                }
             }
         }
     }
 
-    first_write_ = writeset[0];
-
     //phase1
 #if STO_SORT_WRITESET
     std::sort(writeset, writeset + nwriteset, [&] (unsigned i, unsigned j) {
-        TransItem* ti = &tset_[i / tset_chunk][i % tset_chunk];
-        TransItem* tj = &tset_[j / tset_chunk][j % tset_chunk];
-        return *ti < *tj;
+        return *tset_item(i) < *tset_item(j);
     });
-
+#endif
     if (nwriteset) {
         state_ = s_committing_locked;
         auto writeset_end = writeset + nwriteset;
-        for (auto it = writeset; it != writeset_end; ) {
-            TransItem* me = &tset_[*it / tset_chunk][*it % tset_chunk];
+        for (auto idxit = writeset; idxit != writeset_end; ++idxit) {
+            TransItem* me = tset_item(*idxit);
             if (!me->owner()->lock(*me, *this)) {
                 mark_abort_because(me, "commit lock");
                 goto abort;
             }
             me->__or_flags(TransItem::lock_bit);
-            ++it;
         }
+        LATENCY_MARK(lh_lock);
     }
-#endif
 
+#if STO_COMMIT_TID == STO_COMMIT_TID_SHARED
+    // all write locks are held from here on; see commit_tid()
+    if (nwriteset) {
+        fence();
+        tid_snapshot_ = *(volatile tid_type*) &_TID;
+    }
+#endif
 
 #if CONSISTENCY_CHECK
     fence();
@@ -312,17 +791,9 @@ bool Transaction::try_commit() {
 #endif
 
     //phase2
-    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
-        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
-        if (it->has_read()) {
-            TXP_INCREMENT(txp_total_check_read);
-            if (!it->owner()->check(*it, *this)
-                && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
-                mark_abort_because(it, "commit check");
-                goto abort;
-            }
-        }
-    }
+    if (!check_reads())
+        goto abort;
+    LATENCY_MARK(lh_validate);
 
     // fence();
 
@@ -339,15 +810,14 @@ bool Transaction::try_commit() {
     if (nwriteset) {
         auto writeset_end = writeset + nwriteset;
         for (auto idxit = writeset; idxit != writeset_end; ++idxit) {
-            if (likely(*idxit < tset_initial_capacity))
-                it = &tset0_[*idxit];
-            else
-                it = &tset_[*idxit / tset_chunk][*idxit % tset_chunk];
+            it = tset_item(*idxit);
             TXP_INCREMENT(txp_total_w);
             it->owner()->install(*it, *this);
         }
     }
 #endif
+    if (nwriteset)
+        LATENCY_MARK(lh_install);
 
     // fence();
     stop(true, writeset, nwriteset);
@@ -392,13 +862,58 @@ void Transaction::print_stats() {
                 out.p(txp_hco), out.p(txp_hco_lock), out.p(txp_hco_invalid), out.p(txp_hco_abort), out.p(txp_tco),
                 100.0 * (double) out.p(txp_hco) / out.p(txp_tco));
     if (txp_count >= txp_hash_collision)
-        fprintf(stderr, "$ %llu (%.3f%%) hash collisions, %llu second level\n", out.p(txp_hash_collision),
+        fprintf(stderr, "$ %llu (%.3f%%) hash collisions, %llu extra probes\n", out.p(txp_hash_collision),
                 100.0 * (double) out.p(txp_hash_collision) / out.p(txp_hash_find),
                 out.p(txp_hash_collision2));
+    if (txp_count > txp_total_searched)
+        fprintf(stderr, "$ %llu items compared in %llu lookups\n",
+                out.p(txp_total_searched), out.p(txp_hash_find));
     if (txp_count >= txp_total_transbuffer)
         fprintf(stderr, "$ %llu max buffer per txn, %llu total buffer\n",
                 out.p(txp_max_transbuffer), out.p(txp_total_transbuffer));
+    if (txp_count > txp_commit_tid_shared)
+        fprintf(stderr, "$ %llu commit TIDs allocated, %llu shared (%.3f%%)\n",
+                out.p(txp_commit_tid_inc), out.p(txp_commit_tid_shared),
+                100.0 * (double) out.p(txp_commit_tid_shared) / (out.p(txp_commit_tid_inc) + out.p(txp_commit_tid_shared)));
+    if (txp_count > txp_cm_retries_last)
+        for (int p = 0; p != cm_npolicies; ++p)
+            if (out.p(txp_cm_aborts + p) || out.p(txp_cm_retries + p))
+                fprintf(stderr, "$ contention policy %s: %llu lock aborts, %llu retries\n",
+                        cm_policy_name(p), out.p(txp_cm_aborts + p), out.p(txp_cm_retries + p));
     fprintf(stderr, "$ %llu next commit-tid\n", (unsigned long long) _TID);
+    rcu_stats_type rs = rcu_stats();
+    fprintf(stderr, "$ epoch %llu (active %llu), %llu advances (%llu under memory pressure)\n",
+            (unsigned long long) global_epochs.global_epoch,
+            (unsigned long long) global_epochs.active_epoch,
+            (unsigned long long) global_epochs.nadvances,
+            (unsigned long long) global_epochs.npressure_advances);
+    fprintf(stderr, "$ rcu: %zu reclaimed, %zu pending (%zu bytes known), max lag %llu epochs\n",
+            rs.nreclaimed, rs.npending, rs.bytes_pending,
+            (unsigned long long) rs.max_lag);
+
+#if STO_ABORT_ATTRIBUTION
+    print_abort_report(stderr, 10);
+#endif
+
+#if STO_LATENCY_HISTOGRAMS
+    latency_histograms lhs = latency_histograms_combined();
+    for (int p = 0; p != lh_count; ++p) {
+        const latency_histogram& h = lhs.h_[p];
+        if (h.count_)
+            fprintf(stderr, "$ latency %s: %llu samples, mean %.0fns, p50 %.0fns, p99 %.0fns, p999 %.0fns, max %.0fns\n",
+                    latency_histograms::name(p), (unsigned long long) h.count_,
+                    latency_histograms::to_ns(h.mean()),
+                    latency_histograms::to_ns(h.percentile(0.5)),
+                    latency_histograms::to_ns(h.percentile(0.99)),
+                    latency_histograms::to_ns(h.percentile(0.999)),
+                    latency_histograms::to_ns(h.max_));
+    }
+    if (lhs.h_[lh_exec].count_) {
+        fprintf(stderr, "$ latency json: ");
+        print_latency_json(stderr);
+        fprintf(stderr, "\n");
+    }
+#endif
 
 #if STO_TSC_PROFILE
     tc_counters out_tcs = tc_counters_combined();
@@ -415,6 +930,96 @@ void Transaction::print_stats() {
 #endif
 }
 
+void Transaction::print_abort_report(FILE* f, unsigned topn) {
+    struct cause {
+        const TObject* owner;
+        const char* type;
+        uint64_t bucket;
+        std::string reason;
+        uint64_t count;
+    };
+    std::vector<cause> causes;
+    std::map<std::tuple<const TObject*, uint64_t, std::string>, size_t> index;
+    std::map<const TObject*, std::pair<const char*, uint64_t>> objects;
+    uint64_t total = 0, nevicted = 0;
+    for (int i = 0; i < tinfo.limit(); ++i) {
+        threadinfo_t* ti = tinfo.get(i);
+        if (!ti)
+            continue;
+        nevicted += ti->aborts_.nevicted();
+        ti->aborts_.for_each([&] (const abort_table::entry& e) {
+                auto key = std::make_tuple(e.owner, e.bucket, std::string(e.reason));
+                auto it = index.find(key);
+                if (it == index.end()) {
+                    index.emplace(key, causes.size());
+                    causes.push_back({e.owner, e.type, e.bucket, e.reason, 0});
+                    it = index.find(key);
+                }
+                causes[it->second].count += e.count;
+                auto& obj = objects[e.owner];
+                obj.first = e.type;
+                obj.second += e.count;
+                total += e.count;
+            });
+    }
+    if (!total)
+        return;
+
+    fprintf(f, "$ abort attribution: %llu aborts", (unsigned long long) total);
+    if (nevicted)
+        fprintf(f, ", %llu causes evicted (counts may overestimate)", (unsigned long long) nevicted);
+    fprintf(f, "\n");
+
+    fprintf(f, "$ aborts by object:\n");
+    std::vector<std::pair<uint64_t, const TObject*>> hot_objects;
+    for (auto& o : objects)
+        hot_objects.emplace_back(o.second.second, o.first);
+    std::sort(hot_objects.begin(), hot_objects.end(), std::greater<std::pair<uint64_t, const TObject*>>());
+    if (hot_objects.size() > topn)
+        hot_objects.resize(topn);
+    for (auto& o : hot_objects) {
+        if (o.second)
+            fprintf(f, "$   %10llu (%6.2f%%) %s %p\n", (unsigned long long) o.first,
+                    100.0 * o.first / total, objects[o.second].first, (const void*) o.second);
+        else
+            fprintf(f, "$   %10llu (%6.2f%%) no object\n", (unsigned long long) o.first,
+                    100.0 * o.first / total);
+    }
+
+    std::sort(causes.begin(), causes.end(), [] (const cause& a, const cause& b) {
+            return a.count > b.count;
+        });
+    if (causes.size() > topn)
+        causes.resize(topn);
+    fprintf(f, "$ hottest abort causes:\n");
+    for (auto& c : causes) {
+        if (c.owner)
+            fprintf(f, "$   %10llu (%6.2f%%) %s %p bucket %#llx: %s\n",
+                    (unsigned long long) c.count, 100.0 * c.count / total,
+                    c.type, (const void*) c.owner, (unsigned long long) c.bucket,
+                    c.reason.c_str());
+        else
+            fprintf(f, "$   %10llu (%6.2f%%) %s\n", (unsigned long long) c.count,
+                    100.0 * c.count / total, c.reason.c_str());
+    }
+}
+
+void Transaction::print_latency_json(FILE* f) {
+    latency_histograms lhs = latency_histograms_combined();
+    fprintf(f, "{\"unit\":\"ns\"");
+    for (int p = 0; p != lh_count; ++p) {
+        const latency_histogram& h = lhs.h_[p];
+        fprintf(f, ",\"%s\":{\"count\":%llu,\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}",
+                latency_histograms::name(p), (unsigned long long) h.count_,
+                latency_histograms::to_ns(h.mean()),
+                latency_histograms::to_ns(h.percentile(0.5)),
+                latency_histograms::to_ns(h.percentile(0.99)),
+                latency_histograms::to_ns(h.percentile(0.999)),
+                latency_histograms::to_ns(h.max_));
+    }
+    fprintf(f, "}");
+}
+
 const char* Transaction::state_name(int state) {
     static const char* names[] = {"in-progress", "opacity-check", "committing", "committing-locked", "aborted", "committed"};
     if (unsigned(state) < arraysize(names))
@@ -450,6 +1055,10 @@ void TObject::print(std::ostream& w, const TransItem& item) const {
     w << "}";
 }
 
+uint64_t TObject::abort_bucket(const TransItem& item) const {
+    return reinterpret_cast<uintptr_t>(item.key<void*>());
+}
+
 std::ostream& operator<<(std::ostream& w, const Transaction& txn) {
     txn.print(w);
     return w;
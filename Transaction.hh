@@ -5,6 +5,7 @@
 #include "small_vector.hh"
 #include "TRcu.hh"
 #include <algorithm>
+#include <cstdio>
 #include <functional>
 #include <memory>
 #include <type_traits>
@@ -18,6 +19,9 @@
 #ifndef STO_TSC_PROFILE
 #define STO_TSC_PROFILE 0
 #endif
+#ifndef STO_LATENCY_HISTOGRAMS
+#define STO_LATENCY_HISTOGRAMS 1
+#endif
 
 #ifndef BILLION
 #define BILLION 1000000000.0
@@ -43,10 +47,25 @@
 #define STO_DEBUG_ABORTS_FRACTION 0.0001
 #endif
 
+#ifndef STO_ABORT_ATTRIBUTION
+#define STO_ABORT_ATTRIBUTION 1
+#endif
+
 #ifndef STO_SORT_WRITESET
 #define STO_SORT_WRITESET 0
 #endif
 
+// Commit TID allocation.
+// STO_COMMIT_TID_GLOBAL: every committing writer increments _TID.
+// STO_COMMIT_TID_SHARED: a writer that sees _TID advance after it has locked
+// its write set reuses the TID allocated by that advance instead of
+// incrementing _TID itself (similar to TL2 GV4).
+#define STO_COMMIT_TID_GLOBAL 0
+#define STO_COMMIT_TID_SHARED 1
+#ifndef STO_COMMIT_TID
+#define STO_COMMIT_TID STO_COMMIT_TID_GLOBAL
+#endif
+
 #ifndef DEBUG_SKEW
 #define DEBUG_SKEW 0
 #endif
@@ -75,6 +94,20 @@
 #endif
 #endif
 
+// Contention management policies; see Transaction::cm_config
+enum cm_policy {
+    cm_default = 0,     // STO_SPIN_* compile-time lock spinning, blind retry
+    cm_expbackoff,      // exponential backoff on locks and between retries
+    cm_karma,           // wait for holders that did less work, else abort
+    cm_wait_die,        // older transactions wait, younger ones abort
+    cm_abort_on_locked, // abort as soon as a lock is held
+    cm_npolicies
+};
+
+#ifndef STO_CM_POLICY
+#define STO_CM_POLICY cm_default
+#endif
+
 #define CONSISTENCY_CHECK 0
 #define ASSERT_TX_SIZE 0
 #define TRANSACTION_HASHTABLE 1
@@ -93,7 +126,9 @@
 // Dim: time measuring
 #include "../util/measure_latencies.hh"
 
-#define MAX_THREADS 32
+#ifndef MAX_THREADS
+#define MAX_THREADS 256
+#endif
 
 #define BACKOFF 1
 #define BACKOFF_MAX 64
@@ -267,6 +302,13 @@ enum txp {
     txp_hash_collision,
     txp_hash_collision2,
     txp_total_searched,
+    txp_commit_tid_inc,
+    txp_commit_tid_shared,
+    // lock acquisitions given up and retries, one counter per cm_policy
+    txp_cm_aborts,
+    txp_cm_aborts_last = txp_cm_aborts + cm_npolicies - 1,
+    txp_cm_retries,
+    txp_cm_retries_last = txp_cm_retries + cm_npolicies - 1,
 #if !STO_PROFILE_COUNTERS
     txp_count = 0
 #elif STO_PROFILE_COUNTERS == 1
@@ -363,6 +405,178 @@ struct tc_counters {
     }
 };
 
+// Per-phase commit latency histograms (in TSC cycles)
+enum LatencyPhases {
+    lh_exec = 0,        // start() to try_commit()
+    lh_lock,            // write set locking
+    lh_validate,        // read set validation
+    lh_install,         // write set installation
+    lh_count
+};
+
+// Log-linear histogram: values below 2^lh_sub_bits get exact buckets;
+// larger values get 2^lh_sub_bits buckets per power of two, so each
+// bucket's width is at most 1/8 of its lower bound. Values of 2^44
+// cycles or more land in the last bucket.
+struct latency_histogram {
+    static constexpr int sub_bits = 3;
+    static constexpr int max_bits = 44;
+    static constexpr int nbuckets = (max_bits - sub_bits + 1) << sub_bits;
+
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+    uint64_t buckets_[nbuckets];
+
+    latency_histogram() { reset(); }
+
+    static int bucket(uint64_t v) {
+        if (v < (uint64_t(1) << sub_bits))
+            return v;
+        int shift = 63 - __builtin_clzll(v) - sub_bits;
+        int b = ((shift + 1) << sub_bits) + ((v >> shift) & ((1 << sub_bits) - 1));
+        return b < nbuckets ? b : nbuckets - 1;
+    }
+    static uint64_t bucket_low(int b) {
+        if (b < (1 << sub_bits))
+            return b;
+        int shift = (b >> sub_bits) - 1;
+        return uint64_t((1 << sub_bits) + (b & ((1 << sub_bits) - 1))) << shift;
+    }
+    static uint64_t bucket_high(int b) {
+        if (b < (1 << sub_bits))
+            return b;
+        return bucket_low(b) + (uint64_t(1) << ((b >> sub_bits) - 1)) - 1;
+    }
+
+    void add(uint64_t v) {
+        ++buckets_[bucket(v)];
+        ++count_;
+        sum_ += v;
+        if (v > max_)
+            max_ = v;
+    }
+    void merge(const latency_histogram& x) {
+        for (int b = 0; b != nbuckets; ++b)
+            buckets_[b] += x.buckets_[b];
+        count_ += x.count_;
+        sum_ += x.sum_;
+        max_ = std::max(max_, x.max_);
+    }
+    // Returns the upper bound of the bucket holding quantile `q`
+    // (0 <= q <= 1), clamped to the largest recorded value.
+    uint64_t percentile(double q) const {
+        if (!count_)
+            return 0;
+        uint64_t rank = uint64_t(q * count_ + 0.5);
+        if (rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int b = 0; b != nbuckets; ++b) {
+            seen += buckets_[b];
+            if (seen >= rank)
+                return std::min(bucket_high(b), max_);
+        }
+        return max_;
+    }
+    double mean() const {
+        return count_ ? (double) sum_ / count_ : 0;
+    }
+    void reset() {
+        count_ = sum_ = max_ = 0;
+        for (int b = 0; b != nbuckets; ++b)
+            buckets_[b] = 0;
+    }
+};
+
+struct latency_histograms {
+    latency_histogram h_[lh_count];
+    static const char* name(int phase) {
+        static const char* names[] = {"exec", "lock", "validate", "install"};
+        return names[phase];
+    }
+    static double to_ns(double cycles) {
+        return cycles / PROC_TSC_FREQ;
+    }
+    void merge(const latency_histograms& x) {
+        for (int p = 0; p != lh_count; ++p)
+            h_[p].merge(x.h_[p]);
+    }
+    void reset() {
+        for (int p = 0; p != lh_count; ++p)
+            h_[p].reset();
+    }
+};
+
+class TObject;
+
+// Abort attribution: counts of aborts per (TObject, key bucket, reason).
+// Each thread owns its table and is its only writer. The table is
+// allocated on the thread's first abort.
+//
+// A cause lives within `window` slots of its hash. When those slots are
+// all taken, the cause with the lowest count is evicted and the new cause
+// inherits that count plus one (the space-saving top-k scheme): a hot
+// cause cannot be locked out by cold ones, and each count overestimates
+// by at most the entry's `error`.
+//
+// Readers scan without locking. Each entry has a sequence number that is
+// odd while the owner replaces it; for_each() skips entries that changed
+// under it. reset() may be called by any thread, so it only requests a
+// clear, which the owner performs on its next abort; until then readers
+// see an empty table.
+struct abort_table {
+    struct entry {
+        unsigned seq;
+        const TObject* owner;  // nullptr: no item was blamed
+        const char* type;      // owner's type name, saved in case it is freed
+        uint64_t bucket;       // TObject::abort_bucket()
+        const char* reason;
+        uint64_t count;
+        uint64_t error;        // count inherited from an evicted cause
+    };
+    static constexpr unsigned capacity = 512;
+    static constexpr unsigned window = 8;
+
+    entry* e_;
+    uint64_t nevicted_;
+    unsigned clear_requested_;
+    unsigned cleared_;
+
+    abort_table()
+        : e_(nullptr), nevicted_(0), clear_requested_(0), cleared_(0) {
+    }
+    ~abort_table() {
+        delete[] e_;
+    }
+
+    void account(const TObject* owner, uint64_t bucket, const char* reason);
+    void reset() {
+        fence();
+        ++clear_requested_;
+    }
+    uint64_t nevicted() const {
+        return clear_requested_ == cleared_ ? nevicted_ : 0;
+    }
+    // Calls f(const entry&) on a consistent copy of every entry in use.
+    template <typename F>
+    void for_each(F f) const {
+        const entry* e = e_;
+        acquire_fence();
+        if (!e || clear_requested_ != cleared_)
+            return;
+        for (unsigned i = 0; i != capacity; ++i) {
+            unsigned seq = e[i].seq;
+            acquire_fence();
+            entry copy = e[i];
+            acquire_fence();
+            if ((seq & 1) || seq != e[i].seq || !copy.reason)
+                continue;
+            f(copy);
+        }
+    }
+};
+
 #include "Interface.hh"
 #include "TransItem.hh"
 
@@ -379,9 +593,40 @@ struct __attribute__((aligned(128))) threadinfo_t {
     std::function<void(void)> trans_end_callback;
     txp_counters p_;
     tc_counters tcs_;
+    latency_histograms lh_;
+    abort_table aborts_;
+    int cm_policy;            // -1: Transaction::cm_config.policy
+    uint64_t cm_priority;     // karma/wait-die priority; higher waits
+    uint64_t cm_karma;        // tset items of this transaction's aborted attempts
     threadinfo_t()
-        : epoch(0) {
+        : epoch(0), cm_policy(-1), cm_priority(0), cm_karma(0) {
+    }
+};
+
+// threadinfo_t objects are registered on a thread id's first use rather than
+// preallocated for all MAX_THREADS ids. Scans over all threads (epoch
+// advancement, counter aggregation) only visit ids below limit().
+class threadinfo_registry {
+public:
+    threadinfo_t& operator[](int i) {
+        threadinfo_t* ti = ti_[i];
+        if (unlikely(!ti))
+            ti = hard_register(i);
+        return *ti;
+    }
+    // returns nullptr if thread id `i` never registered
+    threadinfo_t* get(int i) const {
+        return ti_[i];
     }
+    int limit() const {
+        return limit_;
+    }
+
+private:
+    threadinfo_t* ti_[MAX_THREADS];
+    int limit_;
+
+    threadinfo_t* hard_register(int i);
 };
 
 template <int T, bool tmp_stats=false>
@@ -417,18 +662,54 @@ class Transaction {
 public:
     static constexpr unsigned tset_initial_capacity = 512;
 
-    static constexpr unsigned hash_size = 1024;
-    static constexpr unsigned hash_step = 5;
+    static constexpr unsigned hash_size = 1024; // initial tset index capacity
     using epoch_type = TRcuSet::epoch_type;
     using signed_epoch_type = TRcuSet::signed_epoch_type;
 
-    static threadinfo_t tinfo[MAX_THREADS];
+    static threadinfo_registry tinfo;
     static struct epoch_state {
         epoch_type global_epoch; // != 0
         epoch_type active_epoch; // no thread is before this epoch
         TransactionTid::type recent_tid;
         bool run;
+        int advancing;           // held while some thread advances the epoch
+        uint64_t advance_tsc;    // read_tsc() at the last advance
+        uint64_t nadvances;
+        uint64_t npressure_advances;
     } global_epochs;
+    // Epoch advancement tunables; may be changed at any time.
+    static struct epoch_config_type {
+        unsigned interval_us;     // period of timed advancement
+        unsigned min_interval_us; // min. gap between pressure-driven advances
+        size_t rcu_threshold;     // per-thread pending rcu objects that
+                                  // trigger advancement (0 disables)
+        bool cooperative;         // threads run timed advancement themselves,
+                                  // no epoch_advancer thread needed
+    } epoch_config;
+    // Commit-time read validation is split across a helper pool for
+    // transactions with at least min_tset items. Helper k runs as thread
+    // id first_threadid + k: the application must not use those ids, and
+    // per-thread tables that check() indexes by TThread::id() must cover
+    // them.
+    static struct validation_config_type {
+        unsigned nhelpers;        // helper threads (0 disables); the pool
+                                  // only grows, up to MAX_THREADS - 1
+        unsigned min_tset;
+        int first_threadid;
+    } validation_config;
+    static struct cm_config_type {
+        int policy;               // process-wide default cm_policy
+        unsigned spin_bound;      // expbackoff: lock attempts before aborting
+        unsigned wait_bound;      // karma/wait-die: lock attempts while waiting
+        unsigned backoff_max;     // max pause (relax_fence()s) between retries
+    } cm_config;
+    static const char* cm_policy_name(int policy);
+    struct rcu_stats_type {
+        size_t npending;
+        size_t bytes_pending;
+        size_t nreclaimed;
+        epoch_type max_lag;       // epochs since oldest pending registration
+    };
     typedef TransactionTid::type tid_type;
 private:
     static TransactionTid::type _TID;
@@ -438,57 +719,100 @@ public:
 
     static txp_counters txp_counters_combined() {
         txp_counters out;
-        for (int i = 0; i != MAX_THREADS; ++i)
+        for (int i = 0; i != tinfo.limit(); ++i) {
+            threadinfo_t* ti = tinfo.get(i);
+            if (!ti)
+                continue;
             for (int p = 0; p != txp_count; ++p) {
                 if (txp_is_max(p))
-                    out.p_[p] = std::max(out.p_[p], tinfo[i].p_.p_[p]);
+                    out.p_[p] = std::max(out.p_[p], ti->p_.p_[p]);
                 else
-                    out.p_[p] += tinfo[i].p_.p_[p];
+                    out.p_[p] += ti->p_.p_[p];
             }
+        }
         return out;
     }
 
     static tc_counters tc_counters_combined() {
         tc_counters ret;
-        for (int i = 0; i < MAX_THREADS; ++i) {
+        for (int i = 0; i < tinfo.limit(); ++i) {
+            threadinfo_t* ti = tinfo.get(i);
+            if (!ti)
+                continue;
             for (int t = 0; t < tc_count; ++t) {
-                ret.tcs_[t] += tinfo[i].tcs_.tcs_[t];
+                ret.tcs_[t] += ti->tcs_.tcs_[t];
             }
         }
         return ret;
     }
 
+    static latency_histograms latency_histograms_combined() {
+        latency_histograms ret;
+        for (int i = 0; i < tinfo.limit(); ++i)
+            if (threadinfo_t* ti = tinfo.get(i))
+                ret.merge(ti->lh_);
+        return ret;
+    }
+
     static void print_stats();
+    // Writes the combined latency histograms' summary as one JSON object.
+    static void print_latency_json(FILE* f);
 
     static void clear_stats() {
-        for (int i = 0; i != MAX_THREADS; ++i) {
-            tinfo[i].p_.reset();
-            tinfo[i].tcs_.reset();
-        }
+        for (int i = 0; i != tinfo.limit(); ++i)
+            if (threadinfo_t* ti = tinfo.get(i)) {
+                ti->p_.reset();
+                ti->tcs_.reset();
+                ti->lh_.reset();
+                ti->aborts_.reset();
+            }
     }
 
+    // Prints the `topn` most frequent (TObject, key bucket, reason) abort
+    // causes, and the TObjects with the most aborts, summed over threads.
+    static void print_abort_report(FILE* f, unsigned topn = 20);
+
     static void* epoch_advancer(void*);
+    static bool advance_epoch(bool pressure = false);
+    static rcu_stats_type rcu_stats();
     template <typename T>
     static void rcu_delete(T* x) {
         auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free, x);
+        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free, x, sizeof(T));
     }
     template <typename T>
     static void rcu_delete_array(T* x) {
         auto& thr = tinfo[TThread::id()];
         thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free_array, x);
     }
-    static void rcu_free(void* ptr) {
+    static void rcu_free(void* ptr, size_t size = 0) {
         auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, ::free, ptr);
+        thr.rcu_set.add(thr.epoch, ::free, ptr, size);
     }
-    static void rcu_call(void (*function)(void*), void* argument) {
+    static void rcu_call(void (*function)(void*), void* argument, size_t size = 0) {
         auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, function, argument);
+        thr.rcu_set.add(thr.epoch, function, argument, size);
     }
     static void rcu_quiesce() {
         tinfo[TThread::id()].epoch = 0;
     }
+    // Lets code outside a transaction read RCU-managed memory (and retire
+    // it with the calls above): pins the calling thread's epoch until
+    // rcu_unpin() is passed the result. Does nothing if the thread already
+    // holds an epoch, e.g. inside a transaction.
+    static epoch_type rcu_pin() {
+        auto& thr = tinfo[TThread::id()];
+        epoch_type e = thr.epoch;
+        if (!e) {
+            thr.epoch = global_epochs.global_epoch;
+            fence();
+        }
+        return e;
+    }
+    static void rcu_unpin(epoch_type pinned) {
+        if (!pinned)
+            tinfo[TThread::id()].epoch = 0;
+    }
 
 #if STO_PROFILE_COUNTERS
     template <unsigned P> static void txp_account(txp_counter_type n) {
@@ -504,8 +828,13 @@ public:
 
 
 private:
+    // The tset is a directory of fixed-size chunks. The directory doubles
+    // as needed; chunks stay allocated for reuse by later transactions, up
+    // to tset_retained_nchunks.
     static constexpr unsigned tset_chunk = 512;
-    static constexpr unsigned tset_max_capacity = 32768;
+    static constexpr unsigned tset_initial_nchunks = 64;
+    static constexpr unsigned tset_retained_nchunks = 256;
+    static constexpr unsigned wset_initial_capacity = 128;
 
     void initialize();
 
@@ -538,29 +867,46 @@ private:
         //if (isAborted_
         //   && tinfo[TThread::id()].p(txp_total_aborts) % 0x10000 == 0xFFFF)
            //print_stats();
-#if STO_TSC_PROFILE
+#if STO_TSC_PROFILE || STO_LATENCY_HISTOGRAMS
         start_tsc_ = read_tsc();
 #endif
         thr.epoch = global_epochs.global_epoch;
         thr.rcu_set.clean_until(global_epochs.active_epoch);
+        if (unlikely(epoch_config.cooperative
+                     || (epoch_config.rcu_threshold
+                         && thr.rcu_set.npending() > epoch_config.rcu_threshold)))
+            epoch_maintenance(thr);
         if (thr.trans_start_callback)
             thr.trans_start_callback();
         hash_base_ += tset_size_ + 1;
         tset_size_ = 0;
         tset_next_ = tset0_;
+        if (unlikely(tset_nallocated_ > tset_retained_nchunks))
+            trim_tset();
 #if TRANSACTION_HASHTABLE
-        if (hash_base_ >= 32768) {
-            memset(hashtable_, 0, sizeof(hashtable_));
+        if (hash_base_ >= hash_base_limit) {
+            memset(hashtable_, 0, sizeof(uint32_t) * (hash_mask_ + 1));
             hash_base_ = 0;
         }
 #endif
+        cm_policy_ = thr.cm_policy >= 0 ? thr.cm_policy : cm_config.policy;
+        if (cm_policy_ == cm_karma || cm_policy_ == cm_wait_die)
+            cm_prioritize(thr);
         any_writes_ = any_nonopaque_ = may_duplicate_items_ = false;
+        any_predicates_ = false;
         first_write_ = 0;
+        wset_size_ = 0;
+        wset_sorted_ = true;
         start_tid_ = commit_tid_ = 0;
+#if STO_COMMIT_TID == STO_COMMIT_TID_SHARED
+        tid_snapshot_ = 0;
+#endif
         buf_.clear();
-#if STO_DEBUG_ABORTS
+#if STO_DEBUG_ABORTS || STO_ABORT_ATTRIBUTION
         abort_item_ = nullptr;
         abort_reason_ = nullptr;
+#endif
+#if STO_DEBUG_ABORTS
         abort_version_ = 0;
 #endif
         TXP_INCREMENT(txp_total_starts);
@@ -568,29 +914,70 @@ private:
     }
 
 #if TRANSACTION_HASHTABLE
-    static int hash(const TObject* obj, void* key) {
+    // The tset index is an open-addressed, linearly probed table holding
+    // hash_base_ + tidx + 1 for every item. Slots <= hash_base_ are empty,
+    // so bumping hash_base_ in start() clears it. It doubles when half full.
+    static constexpr uint32_t hash_base_limit = 0x80000000U;
+
+    unsigned hash(const TObject* obj, void* key) const {
         auto n = reinterpret_cast<uintptr_t>(key) + 0x4000000;
         n += -uintptr_t(n < 0x8000000) & (reinterpret_cast<uintptr_t>(obj) >> 4);
-        //2654435761
-        return (n + (n >> 16) * 9) % hash_size;
+        return (uint64_t(n) * 0x9E3779B97F4A7C15ULL) >> hash_shift_;
     }
+    void grow_hashtable();
 #endif
 
     void refresh_tset_chunk();
+    void grow_tset_directory();
+    void trim_tset();
+
+    TransItem* tset_item(unsigned tidx) const {
+        if (likely(tidx < tset_initial_capacity))
+            return const_cast<TransItem*>(&tset0_[tidx]);
+        else
+            return &tset_[tidx / tset_chunk][tidx % tset_chunk];
+    }
+    unsigned tset_index(const TransItem* it) const {
+        if (likely(it == tset_next_ - 1))
+            return tset_size_ - 1;
+        uintptr_t delta = reinterpret_cast<uintptr_t>(it) - reinterpret_cast<uintptr_t>(tset0_);
+        if (delta < sizeof(tset0_))
+            return delta / sizeof(TransItem);
+        return hard_tset_index(it);
+    }
+    unsigned hard_tset_index(const TransItem* it) const;
+
+    // Written items are recorded as add_write() first marks them, so
+    // commit need not scan the tset for them. Entries may be stale
+    // (clear_write()) or repeated; try_commit filters them. Proxies from
+    // item lookups carry the index; others fall back to tset_index().
+    void record_write(const TransItem* it, unsigned tidx) {
+        if (tidx == TransProxy::unknown_index)
+            tidx = tset_index(it);
+        if (unlikely(wset_size_ == wset_capacity_))
+            grow_wset();
+        if (wset_size_ && tidx <= wset_[wset_size_ - 1])
+            wset_sorted_ = false;
+        wset_[wset_size_++] = tidx;
+        any_writes_ = true;
+    }
+    void grow_wset();
 
     TransItem* allocate_item(const TObject* obj, void* xkey) {
         if (tset_size_ && tset_size_ % tset_chunk == 0)
             refresh_tset_chunk();
+#if TRANSACTION_HASHTABLE
+        if (unlikely(tset_size_ >= (hash_mask_ + 1) / 2))
+            grow_hashtable();
+#endif
         ++tset_size_;
         new(reinterpret_cast<void*>(tset_next_)) TransItem(const_cast<TObject*>(obj), xkey);
 #if TRANSACTION_HASHTABLE
+        // duplicates probe after earlier copies, so lookups find the first
         unsigned hi = hash(obj, xkey);
-# if TRANSACTION_HASHTABLE > 1
-        if (hashtable_[hi] > hash_base_)
-            hi = (hi + hash_step) % hash_size;
-# endif
-        if (hashtable_[hi] <= hash_base_)
-            hashtable_[hi] = hash_base_ + tset_size_;
+        while (hashtable_[hi] > hash_base_)
+            hi = (hi + 1) & hash_mask_;
+        hashtable_[hi] = hash_base_ + tset_size_;
 #endif
         return tset_next_++;
     }
@@ -604,7 +991,8 @@ public:
     template <typename T>
     TransProxy new_item(const TObject* obj, T key) {
         void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
-        return TransProxy(*this, *allocate_item(obj, xkey));
+        TransItem* ti = allocate_item(obj, xkey);
+        return TransProxy(*this, *ti, tset_size_ - 1);
     }
 
     // adds item without checking its presence in the array
@@ -612,17 +1000,21 @@ public:
     TransProxy fresh_item(const TObject* obj, T key) {
         may_duplicate_items_ = tset_size_ > 0;
         void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
-        return TransProxy(*this, *allocate_item(obj, xkey));
+        TransItem* ti = allocate_item(obj, xkey);
+        return TransProxy(*this, *ti, tset_size_ - 1);
     }
 
     // tries to find an existing item with this key, otherwise adds it
     template <typename T>
     TransProxy item(const TObject* obj, T key) {
         void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
-        TransItem* ti = find_item(const_cast<TObject*>(obj), xkey);
-        if (!ti)
+        unsigned tidx = TransProxy::unknown_index;
+        TransItem* ti = find_item(const_cast<TObject*>(obj), xkey, &tidx);
+        if (!ti) {
             ti = allocate_item(obj, xkey);
-        return TransProxy(*this, *ti);
+            tidx = tset_size_ - 1;
+        }
+        return TransProxy(*this, *ti, tidx);
     }
 
     // gets an item that is intended to be read only. this method essentially allows for duplicate items
@@ -631,43 +1023,49 @@ public:
     TransProxy read_item(const TObject* obj, T key) {
         void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
         TransItem* ti = nullptr;
+        unsigned tidx = TransProxy::unknown_index;
         if (any_writes_)
-            ti = find_item(const_cast<TObject*>(obj), xkey);
+            ti = find_item(const_cast<TObject*>(obj), xkey, &tidx);
         else
             may_duplicate_items_ = tset_size_ > 0;
-        if (!ti)
+        if (!ti) {
             ti = allocate_item(obj, xkey);
-        return TransProxy(*this, *ti);
+            tidx = tset_size_ - 1;
+        }
+        return TransProxy(*this, *ti, tidx);
     }
 
     template <typename T>
     OptionalTransProxy check_item(const TObject* obj, T key) const {
         void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
-        TransItem* ti = find_item(const_cast<TObject*>(obj), xkey);
-        return OptionalTransProxy(const_cast<Transaction&>(*this), ti);
+        unsigned tidx = TransProxy::unknown_index;
+        TransItem* ti = find_item(const_cast<TObject*>(obj), xkey, &tidx);
+        return OptionalTransProxy(const_cast<Transaction&>(*this), ti, tidx);
     }
 
 private:
-    // tries to find an existing item with this key, returns NULL if not found
-    TransItem* find_item(TObject* obj, void* xkey) const {
+    // tries to find an existing item with this key, returns NULL if not found;
+    // sets *tidx to its tset index
+    TransItem* find_item(TObject* obj, void* xkey, unsigned* tidx) const {
 #if STO_TSC_PROFILE
         TimeKeeper<tc_find_item> tk;
 #endif
 #if TRANSACTION_HASHTABLE
         TXP_INCREMENT(txp_hash_find);
         unsigned hi = hash(obj, xkey);
-        for (int steps = 0; steps < TRANSACTION_HASHTABLE; ++steps) {
-            if (hashtable_[hi] <= hash_base_)
-                return nullptr;
-            unsigned tidx = hashtable_[hi] - hash_base_ - 1;
+        for (bool first = true; hashtable_[hi] > hash_base_; first = false) {
+            unsigned i = hashtable_[hi] - hash_base_ - 1;
             const TransItem* ti;
-            if (likely(tidx < tset_initial_capacity))
-                ti = &tset0_[tidx];
+            if (likely(i < tset_initial_capacity))
+                ti = &tset0_[i];
             else
-                ti = &tset_[tidx / tset_chunk][tidx % tset_chunk];
-            if (ti->owner() == obj && ti->key_ == xkey)
+                ti = &tset_[i / tset_chunk][i % tset_chunk];
+            TXP_INCREMENT(txp_total_searched);
+            if (ti->owner() == obj && ti->key_ == xkey) {
+                *tidx = i;
                 return const_cast<TransItem*>(ti);
-            if (!steps) {
+            }
+            if (first) {
                 TXP_INCREMENT(txp_hash_collision);
 # if STO_DEBUG_HASH_COLLISIONS
                 if (local_random() <= uint32_t(0xFFFFFFFF * STO_DEBUG_HASH_COLLISIONS_FRACTION)) {
@@ -679,17 +1077,21 @@ private:
 # endif
             } else
                 TXP_INCREMENT(txp_hash_collision2);
-            hi = (hi + hash_step) % hash_size;
+            hi = (hi + 1) & hash_mask_;
         }
-#endif
+        return nullptr;
+#else
         const TransItem* it = nullptr;
-        for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
-            it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
+        for (unsigned i = 0; i != tset_size_; ++i) {
+            it = (i % tset_chunk ? it + 1 : tset_[i / tset_chunk]);
             TXP_INCREMENT(txp_total_searched);
-            if (it->owner() == obj && it->key_ == xkey)
+            if (it->owner() == obj && it->key_ == xkey) {
+                *tidx = i;
                 return const_cast<TransItem*>(it);
+            }
         }
         return nullptr;
+#endif
     }
 
     bool preceding_duplicate_read(TransItem *it) const;
@@ -701,6 +1103,11 @@ private:
         if (version)
             abort_version_ = version;
     }
+#elif STO_ABORT_ATTRIBUTION
+    void mark_abort_because(TransItem* item, const char* reason, TVersion::type = 0) const {
+        abort_item_ = item;
+        abort_reason_ = reason;
+    }
 #else
     void mark_abort_because(TransItem*, const char*, TVersion::type = 0) const {
     }
@@ -760,29 +1167,27 @@ public:
             if (TransactionTid::try_lock(vers, threadid_))
                 return true;
             ++n;
-# if STO_SPIN_EXPBACKOFF
-            if (item.has_read() || n == STO_SPIN_BOUND_WRITE) {
-#  if STO_DEBUG_ABORTS
-                abort_version_ = vers;
-#  endif
-                return false;
-            }
-            if (n > 3)
-                for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
-                    relax_fence();
-# else
-            if (item.has_read() || n == (1 << STO_SPIN_BOUND_WRITE)) {
-#  if STO_DEBUG_ABORTS
+            if (item.has_read() || !cm_wait(vers, n)) {
+# if STO_DEBUG_ABORTS
                 abort_version_ = vers;
-#  endif
+# endif
+                cm_account(txp_cm_aborts);
                 return false;
             }
-# endif
-            relax_fence();
         }
 #endif
     }
 
+    cm_policy contention_policy() const {
+        return cm_policy(cm_policy_);
+    }
+    // overrides the thread's policy for the rest of this transaction
+    void set_contention_policy(cm_policy policy) {
+        cm_policy_ = policy;
+        if (policy == cm_karma || policy == cm_wait_die)
+            cm_prioritize(tinfo[threadid_]);
+    }
+
     void check_opacity(TransItem& item, TransactionTid::type v) {
 #if STO_TSC_PROFILE
         TimeKeeper<tc_opacity> tk;
@@ -819,8 +1224,28 @@ public:
 #if !CONSISTENCY_CHECK
         assert(state_ == s_committing_locked || state_ == s_committing);
 #endif
-        if (!commit_tid_)
+        if (!commit_tid_) {
+#if STO_COMMIT_TID == STO_COMMIT_TID_SHARED
+            // Our whole write set has been locked since tid_snapshot_ was
+            // read. If _TID moved since then, the TID it moved past was
+            // allocated by a transaction whose locks overlapped ours, so
+            // its write set is disjoint from ours and we can share it.
+            // That TID is still greater than any version we overwrite and
+            // smaller than the _TID read by anyone who starts after we
+            // locked.
+            tid_type t = *(volatile tid_type*) &_TID;
+            if (tid_snapshot_ && t != tid_snapshot_) {
+                commit_tid_ = t - TransactionTid::increment_value;
+                TXP_INCREMENT(txp_commit_tid_shared);
+            } else {
+                commit_tid_ = fetch_and_add(&_TID, TransactionTid::increment_value);
+                TXP_INCREMENT(txp_commit_tid_inc);
+            }
+#else
             commit_tid_ = fetch_and_add(&_TID, TransactionTid::increment_value);
+            TXP_INCREMENT(txp_commit_tid_inc);
+#endif
+        }
         return commit_tid_;
     }
     void set_version(TVersion& vers, TVersion::type flags = 0) const {
@@ -872,34 +1297,81 @@ private:
     };
 
     int threadid_;
-    uint16_t hash_base_;
-    uint16_t first_write_;
+    uint32_t hash_base_;
+    unsigned first_write_;
     uint8_t state_;
     bool any_writes_;
     bool any_nonopaque_;
     bool may_duplicate_items_;
+    bool any_predicates_;
+    bool wset_sorted_;
+    uint8_t cm_policy_;
+    unsigned cm_attempt_;     // retries so far, set by TransactionLoopGuard
     bool is_test_;
     TransItem* tset_next_;
     unsigned tset_size_;
     mutable tid_type start_tid_;
     mutable tid_type commit_tid_;
+#if STO_COMMIT_TID == STO_COMMIT_TID_SHARED
+    tid_type tid_snapshot_;
+#endif
     mutable TransactionBuffer buf_;
     mutable uint32_t lrng_state_;
-#if STO_DEBUG_ABORTS
+#if STO_DEBUG_ABORTS || STO_ABORT_ATTRIBUTION
     mutable TransItem* abort_item_;
     mutable const char* abort_reason_;
+#endif
+#if STO_DEBUG_ABORTS
     mutable TVersion::type abort_version_;
 #endif
-#if STO_TSC_PROFILE
+#if STO_TSC_PROFILE || STO_LATENCY_HISTOGRAMS
     mutable tc_counter_type start_tsc_;
 #endif
-    TransItem* tset_[tset_max_capacity / tset_chunk];
+    TransItem** tset_;
+    unsigned tset_nchunks_;   // directory size
+    unsigned tset_nallocated_; // heap-allocated chunks
+    TransItem* tset_dir0_[tset_initial_nchunks];
+    unsigned* wset_;
+    unsigned wset_size_;
+    unsigned wset_capacity_;
+    unsigned wset0_[wset_initial_capacity];
 #if TRANSACTION_HASHTABLE
-    uint16_t hashtable_[hash_size];
+    unsigned hash_shift_;
+    unsigned hash_mask_;
+    uint32_t* hashtable_;
+    uint32_t hashtable0_[hash_size];
 #endif
     TransItem tset0_[tset_initial_capacity];
 
     void hard_check_opacity(TransItem* item, TransactionTid::type t);
+    static void epoch_maintenance(threadinfo_t& thr);
+
+    void cm_prioritize(threadinfo_t& thr) {
+        if (cm_policy_ == cm_karma) {
+            if (!cm_attempt_)
+                thr.cm_karma = 0;
+            thr.cm_priority = thr.cm_karma;
+        } else if (!cm_attempt_)
+            // wait-die: older is higher; retries keep their timestamp
+            thr.cm_priority = ~read_tsc();
+    }
+    bool cm_wait(TransactionTid::type v, unsigned n);
+    void cm_backoff(unsigned attempt);
+    void cm_account(unsigned base) {
+#if STO_PROFILE_COUNTERS > 1
+        ++tinfo[threadid_].p_.p_[base + cm_policy_];
+#else
+        (void) base;
+#endif
+    }
+
+    static constexpr unsigned validation_block = 8 * 512; // items per work unit
+    struct validation_job;
+    struct validation_helper_args;
+    bool check_reads();
+    int check_reads_parallel();
+    void check_read_blocks(validation_job& job);
+    static void* validation_helper(void* arg);
     void stop(bool committed, unsigned* writes, unsigned nwrites);
 
     friend class TransProxy;
@@ -907,6 +1379,7 @@ private:
     friend class Sto;
     friend class TestTransaction;
     friend class TNonopaqueVersion;
+    friend class TransactionLoopGuard;
 };
 
 template <int T, bool tmp_stats>
@@ -956,6 +1429,24 @@ public:
             TThread::txn->silent_abort();
     }
 
+    // abort, blaming `item` in the abort attribution report
+    static void abort_because(TransItem& item, const char* reason) {
+        always_assert(in_progress());
+        TThread::txn->abort_because(item, reason);
+    }
+
+    // contention policy for the rest of the current transaction
+    static void set_contention_policy(cm_policy policy) {
+        always_assert(in_progress());
+        TThread::txn->set_contention_policy(policy);
+    }
+    // default policy for this thread's transactions; -1 restores
+    // Transaction::cm_config.policy
+    static void set_thread_contention_policy(int policy) {
+        assert(policy >= -1 && policy < cm_npolicies);
+        Transaction::tinfo[TThread::id()].cm_policy = policy;
+    }
+
     template <typename T>
     static TransProxy item(const TObject* s, T key) {
         always_assert(in_progress());
@@ -1067,13 +1558,19 @@ class TransactionGuard {
 
 class TransactionLoopGuard {
   public:
-    TransactionLoopGuard() {
+    TransactionLoopGuard()
+        : attempts_(0) {
     }
     ~TransactionLoopGuard() {
         if (TThread::txn->in_progress())
             TThread::txn->silent_abort();
+        TThread::txn->cm_attempt_ = 0;
     }
     void start() {
+        Transaction* t = Sto::transaction();
+        if (attempts_)
+            t->cm_backoff(attempts_);
+        t->cm_attempt_ = attempts_++;
         Sto::start_transaction();
     }
     void silent_abort() {
@@ -1083,6 +1580,9 @@ class TransactionLoopGuard {
     bool try_commit() {
         return TThread::txn->try_commit();
     }
+
+  private:
+    unsigned attempts_;
 };
 
 
@@ -1182,6 +1682,7 @@ inline TransProxy& TransProxy::update_read(T old_rdata, T new_rdata) {
 inline TransProxy& TransProxy::set_predicate() {
     assert(!has_read());
     item().__or_flags(TransItem::predicate_bit);
+    t()->any_predicates_ = true;
     return *this;
 }
 
@@ -1190,6 +1691,7 @@ inline TransProxy& TransProxy::set_predicate(T pdata) {
     assert(!has_read());
     item().__or_flags(TransItem::predicate_bit);
     item().rdata_ = Packer<T>::pack(t()->buf_, std::move(pdata));
+    t()->any_predicates_ = true;
     return *this;
 }
 
@@ -1204,7 +1706,7 @@ inline T& TransProxy::predicate_value(T default_pdata) {
 inline TransProxy& TransProxy::add_write() {
     if (!has_write()) {
         item().__or_flags(TransItem::write_bit);
-        t()->any_writes_ = true;
+        t()->record_write(&item(), tidx_);
     }
     return *this;
 }
@@ -1225,7 +1727,7 @@ inline TransProxy& TransProxy::add_write(Args&&... args) {
     if (!has_write()) {
         item().__or_flags(TransItem::write_bit);
         item().wdata_ = Packer<T>::pack(t()->buf_, std::forward<Args>(args)...);
-        t()->any_writes_ = true;
+        t()->record_write(&item(), tidx_);
     } else
         // TODO: this assumes that a given writer data always has the same type.
         // this is certainly true now but we probably shouldn't assume this in general
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "Transaction.hh"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+/*
+ *    Value arena
+ *    -----------
+ *    A size-class slab allocator for MassTrans string values
+ *    (versioned_str_struct). Each thread keeps a free list per size class
+ *    and carves new objects out of slab_size slabs; bigger objects than
+ *    max_class_size go to malloc. The classes follow stuffed_str::pad:
+ *    16-byte steps up to 512 bytes, then powers of two. A value therefore
+ *    has room to grow a little, and an update that still fits is written
+ *    in place.
+ *
+ *    free() puts an object on the calling thread's free list at once. An
+ *    object that other transactions may still be reading must go through
+ *    Transaction::rcu_call first, as versioned_str_struct::deallocate_rcu
+ *    does; the callback runs on the freeing thread once every transaction
+ *    that could see the object is over. Slab memory is reused but never
+ *    returned to the system.
+ */
+
+class value_arena {
+public:
+    static constexpr size_t slab_size = 256 << 10;
+    static constexpr size_t max_class_size = 64 << 10;
+
+    // `n` bytes, 16-byte aligned
+    static void* alloc(size_t n) {
+        if (n > max_class_size) {
+            ++state().st.large;
+            return checked_malloc(n);
+        }
+        thread_state& ts = state();
+        unsigned c = size_class(n);
+        ++ts.st.allocs;
+        if (free_obj* o = ts.free[c]) {
+            ts.free[c] = o->next;
+            ++ts.st.reused;
+            return o;
+        }
+        size_t sz = class_size(c);
+        if (sz > ts.left) {
+            retire_slab(ts);
+            ts.cur = static_cast<char*>(checked_malloc(slab_size));
+            ts.left = slab_size;
+            ts.st.slab_bytes += slab_size;
+        }
+        void* p = ts.cur;
+        ts.cur += sz;
+        ts.left -= sz;
+        return p;
+    }
+    // frees an object of `n` bytes from alloc(), now
+    static void free(void* p, size_t n) {
+        if (n > max_class_size) {
+            ::free(p);
+            return;
+        }
+        push(state(), size_class(n), p);
+    }
+
+    // a Malloc for stuffed_str::make()
+    struct allocator {
+        void* operator()(size_t n) {
+            return alloc(n);
+        }
+    };
+
+    // the size alloc(n) really allocates
+    static size_t alloc_size(size_t n) {
+        return n > max_class_size ? n : class_size(size_class(n));
+    }
+
+    struct stats {
+        uint64_t allocs;     // slab allocations
+        uint64_t reused;     // of which from a free list
+        uint64_t large;      // allocations too big for a slab
+        uint64_t slab_bytes; // slab memory
+    };
+    // sum over all threads; call once the workers are done
+    static stats total() {
+        stats t;
+        memset(&t, 0, sizeof(t));
+        for (int i = 0; i < MAX_THREADS; ++i) {
+            const stats& s = states()[i].st;
+            t.allocs += s.allocs;
+            t.reused += s.reused;
+            t.large += s.large;
+            t.slab_bytes += s.slab_bytes;
+        }
+        return t;
+    }
+    static void print_report(FILE* f) {
+        stats t = total();
+        if (!t.allocs && !t.large)
+            return;
+        fprintf(f, "Value arena: %lu allocations (%lu reused), %lu large, %.1f MB of slabs\n",
+                (unsigned long) t.allocs, (unsigned long) t.reused,
+                (unsigned long) t.large, t.slab_bytes / 1048576.0);
+    }
+
+private:
+    // 16, 32, ..., 512, then 1K, 2K, ..., max_class_size
+    static constexpr unsigned nsmall = 32;
+    static constexpr unsigned nclasses = nsmall + 7;
+    static_assert((1024U << (nclasses - nsmall - 1)) == max_class_size, "size classes");
+
+    struct free_obj {
+        free_obj* next;
+    };
+    struct thread_state {
+        char* cur;
+        size_t left;
+        free_obj* free[nclasses];
+        stats st;
+    } __attribute__((aligned(128)));
+
+    static thread_state* states() {
+        static thread_state s[MAX_THREADS];
+        return s;
+    }
+    static thread_state& state() {
+        return states()[TThread::id()];
+    }
+
+    static unsigned size_class(size_t n) {
+        if (n <= 512)
+            return n ? (n - 1) / 16 : 0;
+        unsigned c = nsmall;
+        for (size_t sz = 1024; sz < n; sz <<= 1)
+            ++c;
+        return c;
+    }
+    static size_t class_size(unsigned c) {
+        return c < nsmall ? (c + 1) * 16 : size_t(1024) << (c - nsmall);
+    }
+
+    static void push(thread_state& ts, unsigned c, void* p) {
+        free_obj* o = static_cast<free_obj*>(p);
+        o->next = ts.free[c];
+        ts.free[c] = o;
+    }
+    // hands out what is left of the current slab as free objects
+    static void retire_slab(thread_state& ts) {
+        while (ts.left >= 16) {
+            unsigned c = size_class(ts.left);
+            if (class_size(c) > ts.left)
+                --c;
+            push(ts, c, ts.cur);
+            ts.cur += class_size(c);
+            ts.left -= class_size(c);
+        }
+    }
+    static void* checked_malloc(size_t n) {
+        void* p = malloc(n);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+};
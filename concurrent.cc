@@ -13,6 +13,7 @@
 #include "TArray.hh"
 #include "TGeneric.hh"
 #include "Hashtable.hh"
+#include "OpenHashtable.hh"
 #include "Queue.hh"
 #include "Vector.hh"
 #include "TVector.hh"
@@ -41,6 +42,7 @@
 #define USE_MASSTREE_STR 8
 #define USE_HASHTABLE_STR 9
 #define USE_ARRAY_NONOPAQUE 10
+#define USE_OPEN_HASHTABLE 11
 
 // set this to USE_DATASTRUCTUREYOUWANT
 #define DATA_STRUCTURE USE_HASHTABLE
@@ -148,7 +150,7 @@ inline value_type strtoval(const std::string& s) {
 
 volatile mrcu_epoch_type active_epoch = 1;
 
-unsigned initial_seeds[64];
+unsigned initial_seeds[2 * MAX_THREADS];
 
 
 template <int DS> struct Container {};
@@ -301,6 +303,12 @@ template <> struct Container<USE_MASSTREE> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(IntStr(key).str(), value);
     }
+    // keys 0..n-1 with values val(i+1), as prepopulate_func would
+    void bulk_load(int n, int nthreads) {
+        v_.bulk_load(n, nthreads, [] (size_t i) {
+            return std::make_pair(std::to_string(i), val(i+1));
+        });
+    }
     static void init() {
         Transaction::epoch_advance_callback = [] (unsigned) {
             // just advance blindly because of the way Masstree uses epochs
@@ -347,6 +355,11 @@ template <> struct Container<USE_MASSTREE_STR> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(IntStr(key).str(), valtostr(value));
     }
+    void bulk_load(int n, int nthreads) {
+        v_.bulk_load(n, nthreads, [] (size_t i) {
+            return std::make_pair(std::to_string(i), valtostr(val(i+1)));
+        });
+    }
     static void init() {
         Transaction::epoch_advance_callback = [] (unsigned) {
             // just advance blindly because of the way Masstree uses epochs
@@ -368,6 +381,14 @@ template <> struct Container<USE_HASHTABLE> {
 #endif
     typedef int index_type;
     static constexpr bool has_delete = true;
+#ifndef BOOSTING
+    explicit Container(unsigned nbuckets = static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR))
+        : v_(nbuckets) {
+    }
+    size_t nbuckets() {
+        return v_.nbuckets();
+    }
+#endif
     value_type nontrans_get(index_type key) {
         return v_.unsafe_get(key);
     }
@@ -388,6 +409,13 @@ template <> struct Container<USE_HASHTABLE> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(key, value);
     }
+#ifndef BOOSTING
+    void bulk_load(int n, int nthreads) {
+        v_.bulk_load(n, nthreads, [] (size_t i) {
+            return std::make_pair(int(i), val(i+1));
+        });
+    }
+#endif
     static void init() {
     }
     static void thread_init(Container<USE_HASHTABLE>&) {
@@ -400,6 +428,12 @@ template <> struct Container<USE_HASHTABLE_STR> {
     typedef Hashtable<int, std::string, false, static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR)> type;
     typedef int index_type;
     static constexpr bool has_delete = true;
+    explicit Container(unsigned nbuckets = static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR))
+        : v_(nbuckets) {
+    }
+    size_t nbuckets() {
+        return v_.nbuckets();
+    }
     value_type nontrans_get(index_type key) {
         return strtoval(v_.unsafe_get(key));
     }
@@ -420,6 +454,11 @@ template <> struct Container<USE_HASHTABLE_STR> {
     bool transUpdate(index_type key, value_type value) {
         return v_.transUpdate(key, valtostr(value));
     }
+    void bulk_load(int n, int nthreads) {
+        v_.bulk_load(n, nthreads, [] (size_t i) {
+            return std::make_pair(int(i), valtostr(val(i+1)));
+        });
+    }
     static void init() {
     }
     static void thread_init(Container<USE_HASHTABLE_STR>&) {
@@ -428,6 +467,44 @@ private:
     type v_;
 };
 
+template <> struct Container<USE_OPEN_HASHTABLE> {
+    // fixed capacity: room for every key the tests use. Values must be
+    // trivially copyable, so string values are stored as ints.
+    typedef OpenHashtable<int, int> type;
+    typedef int index_type;
+    static constexpr bool has_delete = true;
+    Container()
+        : v_(ARRAY_SZ) {
+    }
+    value_type nontrans_get(index_type key) {
+        return val(v_.unsafe_get(key));
+    }
+    value_type transGet(index_type key) {
+        int v;
+        if (!v_.transGet(key, v))
+            return value_type();
+        return val(v);
+    }
+    void transPut(index_type key, value_type value) {
+        v_.transPut(key, unval(value));
+    }
+    bool transDelete(index_type key) {
+        return v_.transDelete(key);
+    }
+    bool transInsert(index_type key, value_type value) {
+        return v_.transInsert(key, unval(value));
+    }
+    bool transUpdate(index_type key, value_type value) {
+        return v_.transUpdate(key, unval(value));
+    }
+    static void init() {
+    }
+    static void thread_init(Container<USE_OPEN_HASHTABLE>&) {
+    }
+private:
+    type v_;
+};
+
 #if DATA_STRUCTURE == USE_QUEUE
 typedef Queue<value_type, ARRAY_SZ> QueueType;
 QueueType* q;
@@ -474,6 +551,42 @@ void prepopulate_func(int *array) {
   }
 }
 
+// Prepopulation. Containers with a parallel bulk loader load with the
+// given number of threads; the rest insert one key per transaction.
+template <int DS> struct BulkLoader {
+    static constexpr bool parallel = false;
+    static void load(Container<DS>& a, int) {
+        prepopulate_func(a);
+    }
+};
+struct ParallelBulkLoader {
+    static constexpr bool parallel = true;
+    template <typename C> static void load(C& a, int threads) {
+        a.bulk_load(prepopulate, threads);
+    }
+};
+#ifndef BOOSTING
+template <> struct BulkLoader<USE_HASHTABLE> : public ParallelBulkLoader {};
+#endif
+template <> struct BulkLoader<USE_HASHTABLE_STR> : public ParallelBulkLoader {};
+template <> struct BulkLoader<USE_MASSTREE> : public ParallelBulkLoader {};
+template <> struct BulkLoader<USE_MASSTREE_STR> : public ParallelBulkLoader {};
+
+// prepopulates `a` using `threads` threads; returns the seconds it took
+template <int DS> double timed_prepopulate(Container<DS>& a, int threads) {
+  struct timeval tv1, tv2;
+  gettimeofday(&tv1, NULL);
+  BulkLoader<DS>::load(a, threads);
+  gettimeofday(&tv2, NULL);
+  return (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0;
+}
+
+void print_load_rate(int threads, double secs) {
+  printf("Loaded %d keys with %d thread%s in %f s: %.0f keys/s\n",
+         prepopulate, threads, threads == 1 ? "" : "s", secs,
+         secs > 0 ? prepopulate / secs : 0);
+}
+
 #if DATA_STRUCTURE == USE_QUEUE
 // FUNCTIONS FOR QUEUE
 void prepopulate_func() {
@@ -581,7 +694,8 @@ template <int DS> struct DSTester : public Tester {
 template <int DS> void DSTester<DS>::initialize() {
     a = new container_type;
     if (prepopulate()) {
-        prepopulate_func(*a);
+        int threads = BulkLoader<DS>::parallel ? nthreads : 1;
+        print_load_rate(threads, timed_prepopulate(*a, threads));
 #if MAINTAIN_TRUE_ARRAY_STATE
         prepopulate_func(true_array_state);
 #endif
@@ -1129,7 +1243,7 @@ template <int DS, bool do_delete> bool RandomRWs<DS, do_delete>::check() {
 #if MAINTAIN_TRUE_ARRAY_STATE
   maintain_true_array_state = !maintain_true_array_state;
 #endif
-  prepopulate_func(*ch);
+  BulkLoader<DS>::load(*ch, nthreads);
 
   for (int i = 0; i < nthreads; ++i) {
       this->template do_run<false>(i);
@@ -1494,6 +1608,208 @@ void print_time(struct timeval tv1, struct timeval tv2) {
   printf("%f\n", (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0);
 }
 
+// Test: BigRead. Analytic transactions that read BIGREAD_NREADS consecutive
+// slots and increment the thread's own slot, so commit validates a huge read
+// set (see Transaction::validation_config).
+#ifndef BIGREAD_NREADS
+#define BIGREAD_NREADS 1000000
+#endif
+
+template <int DS> struct BigRead : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    BigRead() {}
+    void run(int me);
+    bool check();
+    int initial_[MAX_THREADS];
+    int ncommitted_[MAX_THREADS];
+};
+
+template <int DS> void BigRead<DS>::run(int me) {
+  TThread::set_id(me);
+  container_type* a = this->a;
+  container_type::thread_init(*a);
+
+  const long nr = std::min(long(BIGREAD_NREADS), long(ARRAY_SZ));
+  std::uniform_int_distribution<long> startdist(0, ARRAY_SZ - nr);
+  Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+
+  // as many reads in total as ntrans * opspertrans
+  int N = std::max(1L, long(ntrans) * opspertrans / (nthreads * nr));
+  initial_[me] = unval(a->nontrans_get(me));
+  for (int i = 0; i < N; ++i) {
+    Rand transgen_snap = transgen;
+    TRANSACTION {
+      transgen = transgen_snap;
+      long start = startdist(transgen);
+      for (long slot = start; slot != start + nr; ++slot)
+        doRead(*a, slot);
+      auto v = a->transGet(me);
+      a->transPut(me, val(unval(v) + 1));
+    } RETRY(true);
+  }
+  ncommitted_[me] = N;
+}
+
+template <int DS> bool BigRead<DS>::check() {
+  for (int i = 0; i < nthreads; ++i)
+    assert(unval(this->a->nontrans_get(i)) == initial_[i] + ncommitted_[i]);
+  return true;
+}
+
+// Test: GrowRW. Random reads and writes while the container grows
+// GROWRW_FACTOR-fold: it starts with 1/GROWRW_FACTOR of the keys (hash
+// tables sized for just those), and every transaction also inserts its
+// share of the rest, so hash tables resize online under the workload.
+// Reads of keys not inserted yet exercise absent-key validation across
+// the resize. Writes increment the initial keys, which check() sums.
+#ifndef GROWRW_FACTOR
+#define GROWRW_FACTOR 100
+#endif
+
+template <int DS> struct GrowthContainer {
+    static Container<DS>* make(int) {
+        return new Container<DS>;
+    }
+    static void report(Container<DS>&) {
+    }
+};
+#ifndef BOOSTING
+template <> struct GrowthContainer<USE_HASHTABLE> {
+    static Container<USE_HASHTABLE>* make(int nkeys) {
+        return new Container<USE_HASHTABLE>(std::max(1, int(nkeys/HASHTABLE_LOAD_FACTOR)));
+    }
+    static void report(Container<USE_HASHTABLE>& c) {
+        printf("hashtable: %zu buckets\n", c.nbuckets());
+    }
+};
+#endif
+template <> struct GrowthContainer<USE_HASHTABLE_STR> {
+    static Container<USE_HASHTABLE_STR>* make(int nkeys) {
+        return new Container<USE_HASHTABLE_STR>(std::max(1, int(nkeys/HASHTABLE_LOAD_FACTOR)));
+    }
+    static void report(Container<USE_HASHTABLE_STR>& c) {
+        printf("hashtable: %zu buckets\n", c.nbuckets());
+    }
+};
+
+template <int DS> struct GrowRW : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    GrowRW() {}
+    void initialize() override;
+    void run(int me) override;
+    bool check() override;
+    void report() override;
+    int initial_;
+    int total_;
+    long nincrements_[MAX_THREADS];
+};
+
+template <int DS> void GrowRW<DS>::initialize() {
+  total_ = std::min(prepopulate, ARRAY_SZ);
+  initial_ = std::max(1, total_ / GROWRW_FACTOR);
+  this->a = GrowthContainer<DS>::make(initial_);
+  for (int i = 0; i < initial_; ++i) {
+      TRANSACTION {
+          this->a->transPut(i, val(i+1));
+      } RETRY(false);
+  }
+  container_type::init();
+  printf("growing from %d to %d keys\n", initial_, total_);
+}
+
+template <int DS> void GrowRW<DS>::run(int me) {
+  TThread::set_id(me);
+  Sto::update_threadid();
+  container_type* a = this->a;
+  container_type::thread_init(*a);
+
+  std::uniform_int_distribution<long> slotdist(0, total_ - 1);
+  uint32_t write_thresh = (uint32_t) (write_percent * Rand::max());
+  Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+
+  int N = std::max(1, ntrans/nthreads);
+  // this thread inserts keys initial_ + me, initial_ + me + nthreads, ...
+  int per_trans = (total_ - initial_) / (nthreads * N) + 1;
+  int next = initial_ + me;
+  nincrements_[me] = 0;
+  for (int i = 0; i < N || next < total_; ++i) {
+    Rand transgen_snap = transgen;
+    int next_snap = next;
+    int nincrements;
+    TRANSACTION {
+      transgen = transgen_snap;
+      next = next_snap;
+      nincrements = 0;
+      for (int j = 0; j < per_trans && next < total_; ++j, next += nthreads)
+        a->transPut(next, val(next + 1));
+      for (int j = 0; j < opspertrans; ++j) {
+        int slot = slotdist(transgen);
+        if (transgen() <= write_thresh && slot < initial_) {
+          auto v = a->transGet(slot);
+          a->transPut(slot, val(unval(v) + 1));
+          ++nincrements;
+        } else
+          doRead(*a, slot);
+      }
+    } RETRY(true);
+    nincrements_[me] += nincrements;
+  }
+}
+
+template <int DS> bool GrowRW<DS>::check() {
+  long increments = 0, expected = 0;
+  for (int i = 0; i < nthreads; ++i)
+    expected += nincrements_[i];
+  for (int i = 0; i < total_; ++i) {
+    int v = unval(this->a->nontrans_get(i));
+    if (i < initial_)
+      increments += v - (i + 1);
+    else if (v != i + 1) {
+      fprintf(stderr, "index [%d]: %d, expected %d\n", i, v, i + 1);
+      return false;
+    }
+  }
+  if (increments != expected)
+    fprintf(stderr, "%ld increments, expected %ld\n", increments, expected);
+  return increments == expected;
+}
+
+template <int DS> void GrowRW<DS>::report() {
+  GrowthContainer<DS>::report(*this->a);
+}
+
+// Test: BulkLoad. Prepopulates a fresh container with 1, 2, ..., nthreads
+// loader threads and prints each load's rate (containers without a
+// parallel loader load once, serially). The workers do nothing.
+template <int DS> struct BulkLoad : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    BulkLoad() {}
+    void initialize() override;
+    void run(int) override {}
+    bool check() override;
+};
+
+template <int DS> void BulkLoad<DS>::initialize() {
+  int maxthreads = BulkLoader<DS>::parallel ? nthreads : 1;
+  for (int t = 1; t <= maxthreads; ++t) {
+    delete this->a;
+    this->a = new container_type;
+    print_load_rate(t, timed_prepopulate(*this->a, t));
+  }
+  container_type::init();
+}
+
+template <int DS> bool BulkLoad<DS>::check() {
+  for (int i = 0; i < prepopulate; ++i) {
+    int v = unval(this->a->nontrans_get(i));
+    if (v != i + 1) {
+      fprintf(stderr, "index [%d]: %d, expected %d\n", i, v, i + 1);
+      return false;
+    }
+  }
+  return true;
+}
+
 void print_time(double time) {
   printf("%f\n", time);
 }
@@ -1507,7 +1823,8 @@ void print_time(double time) {
     {name, desc, 7, new type<7, ## __VA_ARGS__>},     \
     {name, desc, 8, new type<8, ## __VA_ARGS__>},     \
     {name, desc, 9, new type<9, ## __VA_ARGS__>},     \
-    {name, desc, 10, new type<10, ## __VA_ARGS__>}
+    {name, desc, 10, new type<10, ## __VA_ARGS__>},    \
+    {name, desc, 11, new type<11, ## __VA_ARGS__>}
 
 struct Test {
     const char* name;
@@ -1526,7 +1843,10 @@ struct Test {
     MAKE_TESTER("hotspot", "contending hotspot", HotspotRW),
     MAKE_TESTER("hotspot2", "contending hotspot (less stupid)", Hotspot2RW),
     MAKE_TESTER("singlerw", "increment a single random element", SingleRW),
-    MAKE_TESTER("zipfrw", "Zipf random rw", ZipfRW)
+    MAKE_TESTER("zipfrw", "Zipf random rw", ZipfRW),
+    MAKE_TESTER("bigread", "1M-read transactions", BigRead),
+    MAKE_TESTER("growrw", "randomrw while growing 100x", GrowRW),
+    MAKE_TESTER("bulkload", "prepopulate rate with 1 to N threads", BulkLoad)
 };
 
 struct {
@@ -1538,6 +1858,7 @@ struct {
     {"hashtable", USE_HASHTABLE},
     {"hash", USE_HASHTABLE},
     {"hash-str", USE_HASHTABLE_STR},
+    {"hash-open", USE_OPEN_HASHTABLE},
     {"masstree", USE_MASSTREE},
     {"mass", USE_MASSTREE},
     {"masstree-str", USE_MASSTREE_STR},
@@ -1548,7 +1869,7 @@ struct {
 };
 
 enum {
-    opt_test = 1, opt_nrmyw, opt_check, opt_profile, opt_dump, opt_nthreads, opt_ntrans, opt_opspertrans, opt_opspertrans_ro, opt_writepercent, opt_readonlypercent, opt_blindrandwrites, opt_prepopulate, opt_seed, opt_skew
+    opt_test = 1, opt_nrmyw, opt_check, opt_profile, opt_dump, opt_nthreads, opt_ntrans, opt_opspertrans, opt_opspertrans_ro, opt_writepercent, opt_readonlypercent, opt_blindrandwrites, opt_prepopulate, opt_seed, opt_skew, opt_validation_helpers, opt_validation_min_tset, opt_cm
 };
 
 static const Clp_Option options[] = {
@@ -1566,6 +1887,9 @@ static const Clp_Option options[] = {
   { "prepopulate", 0, opt_prepopulate, Clp_ValInt, Clp_Optional },
   { "seed", 's', opt_seed, Clp_ValUnsigned, 0 },
   { "skew", 0, opt_skew, Clp_ValDouble, Clp_Optional},
+  { "validation-helpers", 0, opt_validation_helpers, Clp_ValUnsigned, 0 },
+  { "validation-min-tset", 0, opt_validation_min_tset, Clp_ValUnsigned, 0 },
+  { "cm", 0, opt_cm, Clp_ValString, 0 },
 };
 
 static void help(const char *name) {
@@ -1584,8 +1908,12 @@ Options:\n\
  --blindrandwrites, do blind random writes for random tests. makes checking impossible\n\
  --prepopulate=PREPOPULATE, prepopulate table with given number of items (default %d)\n\
  --seed=SEED\n\
- --skew=SKEW, skew parameter for zipfrw test type (default %f)\n",
-         name, nthreads, ntrans, opspertrans, write_percent, readonly_percent, prepopulate, zipf_skew);
+ --skew=SKEW, skew parameter for zipfrw test type (default %f)\n\
+ --validation-helpers=N, helper threads for commit-time read validation (default %u)\n\
+ --validation-min-tset=N, validate in parallel from this transaction size (default %u)\n\
+ --cm=POLICY, contention policy: default, expbackoff, karma, wait-die, abort-on-locked\n",
+         name, nthreads, ntrans, opspertrans, write_percent, readonly_percent, prepopulate, zipf_skew,
+         Transaction::validation_config.nhelpers, Transaction::validation_config.min_tset);
   printf("\nTests:\n");
   size_t testidx = 0;
   for (size_t ti = 0; ti != sizeof(tests)/sizeof(tests[0]); ++ti)
@@ -1675,6 +2003,21 @@ int main(int argc, char *argv[]) {
     case opt_skew:
         zipf_skew = clp->val.d;
         break;
+    case opt_validation_helpers:
+        Transaction::validation_config.nhelpers = clp->val.u;
+        break;
+    case opt_validation_min_tset:
+        Transaction::validation_config.min_tset = clp->val.u;
+        break;
+    case opt_cm: {
+        int p = 0;
+        while (p != cm_npolicies && strcmp(clp->val.s, Transaction::cm_policy_name(p)) != 0)
+            ++p;
+        if (p == cm_npolicies)
+            help(argv[0]);
+        Transaction::cm_config.policy = p;
+        break;
+    }
     default:
       help(argv[0]);
     }
@@ -1774,7 +2117,10 @@ int main(int argc, char *argv[]) {
          MAINTAIN_TRUE_ARRAY_STATE, Transaction::tset_initial_capacity, seed, STO_PROFILE_COUNTERS);
   if (!strcmp(tests[test].name, "zipfrw"))
     printf("  Zipf distribution parameter(s): zipf_skew = %f, read-only txn prob. = %f, write prob. = %f\n", zipf_skew, readonly_percent, write_percent);
-  printf("  STO_SORT_WRITESET: %d\n", STO_SORT_WRITESET);
+  printf("  STO_SORT_WRITESET: %d, STO_COMMIT_TID: %s, validation helpers: %u (from %u items), contention policy: %s\n", STO_SORT_WRITESET,
+         STO_COMMIT_TID == STO_COMMIT_TID_SHARED ? "shared" : "global",
+         Transaction::validation_config.nhelpers, Transaction::validation_config.min_tset,
+         Transaction::cm_policy_name(Transaction::cm_config.policy));
 #endif
 
 #if STO_PROFILE_COUNTERS
@@ -159,7 +159,9 @@ public:
   }
 
 private:
-  typedef MassTrans<std::string> mbta_type;
+  // non-opaque, so range scans are validated by rescanning their
+  // interval at commit rather than by leaf versions (MassTrans.hh)
+  typedef MassTrans<std::string, versioned_value_struct<std::string>, false> mbta_type;
   mbta_type mbta;
 
   const std::string name;
@@ -13,6 +13,7 @@ scaling_txlens = [1, 4, 8, 128, 256, 512]
 nthreads_max = multiprocessing.cpu_count()
 nthreads_to_run_full = [1, 2, 4, 8, 16, 24]
 nthreads_to_run_dual = [1, 24]
+nthreads_to_run_many = [1, 2, 4, 8, 16, 24, 32, 48, 64, 96, 128]
 
 def attach_args(bm_idx, nthreads, txlen, opacity, ntrans, writepercent=None):
 	args = [bm_execs[bm_idx], "3"]
@@ -130,6 +131,18 @@ def exp_scalability_hi_contention(repetitions, records):
 
 	save_results("scalability_hi_contention", combined_stdout, records)
 
+def exp_scalability_manythreads(repetitions, records):
+	print "@@@@\n@@@ Starting experiment: scalability-manythreads:"
+	ntxs = 16000000
+	ttr = [n for n in nthreads_to_run_many if n <= nthreads_max]
+	txlen = 10
+	combined_stdout = ""
+
+	for trail in range(0, repetitions):
+		combined_stdout += run_series(0, trail, txlen, 1, records, ttr, ntxs)
+
+	save_results("scalability_manythreads", combined_stdout, records)
+
 def exp_boosting_micro(repetitions, records):
 	print "@@@@\n@@@ Starting experiment: boosting-microbenchmark:"
 	ntxs = 10000000
@@ -210,6 +223,7 @@ def main(argc, argv):
 	exp_scalability_overhead(repetitions, records, 0, [10, 50])
 	exp_scalability_overhead(repetitions, records, 1, [10, 50])
 	#exp_scalability_hi_contention(repetitions, records)
+	#exp_scalability_manythreads(repetitions, records)
 	#exp_scalability_largetx(repetitions, records)
 	#exp_opacity_modes(repetitions, records)
 	#exp_opacity_tl2overhead(repetitions, records)
@@ -5,5 +5,5 @@ then
 fi
 
 
-sed -i -r -e "s/#define BLOOM [0-2]+/#define BLOOM $1/" test_meme.cc
+sed -i -r -e "s/#define BLOOM [0-9]+/#define BLOOM $1/" test_meme.cc
 
@@ -1,11 +1,22 @@
- const int nthreads = 20;
+const int nthreads = 20;
 
 #include "HybridART.hh"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #define NUM_KEYS_MAX 20000000 // 20M keys max
 
 #define BLOOM_TYPE 2
 
+// merge benchmark parameters
+#define MERGE_NUM_KEYS 1000000
+#define MERGE_WORKERS 4
+#define MERGE_WRITERS 2
+#define MERGE_BATCH 1024
+#define MERGE_SAMPLE_MS 50
+
 char * key_dat [NUM_KEYS_MAX];
 
 void loadKey(TID tid, Key &key){
@@ -18,15 +29,182 @@ void loadKeyTART(TID tid, Key &key){
     key.set(key_dat[actual_tid-1], strlen(key_dat[actual_tid-1]));
 }
 
+#if BLOOM_TYPE == 0
+typedef HybridART<uint64_t, DoubleLookup> hybrid_type;
+#elif BLOOM_TYPE == 1
+typedef HybridART<uint64_t, BloomNoPacking> hybrid_type;
+#elif BLOOM_TYPE == 2
+typedef HybridART<uint64_t, BloomPacking> hybrid_type;
+#elif BLOOM_TYPE == 3
+typedef HybridART<uint64_t, BloomSplitBlock> hybrid_type;
+#endif
+
+std::atomic<uint64_t> lookups_done(0);
+std::atomic<uint64_t> writes_done(0);
+std::atomic<bool> workers_stop(false);
+
+TID hybrid_lookup(hybrid_type* hART, uint64_t i, ThreadInfo& t_rw, unsigned thread_id){
+    Key key;
+    loadKey(i, key);
+    TID val = 0;
+    TRANSACTION {
+        lookup_res res = hART->lookup(key, i, t_rw, thread_id);
+        TXN_DO(std::get<1>(res))
+        val = std::get<0>(res);
+    } RETRY(true);
+    return val;
+}
+
+// Looks up random loaded keys, one per transaction, and checks that
+// each one is found in RW or RO while the merge runs.
+void lookup_worker(hybrid_type* hART, unsigned thread_id){
+    TThread::set_id(thread_id);
+    Sto::update_threadid();
+    auto t_rw = hART->getTART().getThreadInfo();
+    uint64_t seed = thread_id + 1;
+    while(!workers_stop.load()){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t i = (seed >> 33) % MERGE_NUM_KEYS + 1;
+        TID val = hybrid_lookup(hART, i, t_rw, thread_id);
+        if(val != i && val != i + MERGE_NUM_KEYS){
+            cerr << "key " << i << " lost during merge (got " << val << ")" << endl;
+            abort();
+        }
+        lookups_done.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Each writer owns the keys i with i % MERGE_WRITERS == w and flips their
+// values between i and i + MERGE_NUM_KEYS (an alias TID for the same key).
+// Every committed value must be the one read back, right after the commit
+// and once the merge is over: an update racing a merge batch must not be
+// lost.
+void write_worker(hybrid_type* hART, unsigned w, unsigned thread_id){
+    TThread::set_id(thread_id);
+    Sto::update_threadid();
+    auto t_rw = hART->getTART().getThreadInfo();
+    const uint64_t nkeys = MERGE_NUM_KEYS / MERGE_WRITERS;
+    std::vector<TID> expected(nkeys);
+    for(uint64_t j = 0; j < nkeys; j++)
+        expected[j] = j * MERGE_WRITERS + w + 1;
+    auto verify = [&] (uint64_t j) {
+        uint64_t i = j * MERGE_WRITERS + w + 1;
+        TID val = hybrid_lookup(hART, i, t_rw, thread_id);
+        if(val != expected[j]){
+            cerr << "update of key " << i << " lost (expected " << expected[j]
+                 << ", got " << val << ")" << endl;
+            abort();
+        }
+    };
+    uint64_t seed = thread_id + 1;
+    while(!workers_stop.load()){
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t j = (seed >> 33) % nkeys;
+        uint64_t i = j * MERGE_WRITERS + w + 1;
+        TID next = expected[j] == i ? i + MERGE_NUM_KEYS : i;
+        Key key;
+        loadKey(i, key);
+        TRANSACTION {
+            TXN_DO(std::get<1>(hART->insert(key, next, t_rw, true, thread_id)))
+        } RETRY(true);
+        expected[j] = next;
+        verify(j);
+        writes_done.fetch_add(1, std::memory_order_relaxed);
+    }
+    for(uint64_t j = 0; j < nkeys; j++)
+        verify(j);
+}
 
 int main(){
+    hybrid_type hART(loadKey, loadKeyTART);
+
+    // load keys into RW
+    TThread::set_id(0);
+    Sto::update_threadid();
+    auto t_rw = hART.getTART().getThreadInfo();
+    for(uint64_t i = 1; i <= MERGE_NUM_KEYS; i++){
+        char buf[32];
+        // fixed width keeps the keys prefix-free, as ART requires
+        snprintf(buf, sizeof(buf), "key%08llu", (unsigned long long) i);
+        key_dat[i-1] = strdup(buf);
+        key_dat[MERGE_NUM_KEYS + i - 1] = key_dat[i-1];
+        Key key;
+        loadKey(i, key);
+        TRANSACTION {
+            TXN_DO(std::get<1>(hART.insert(key, i, t_rw, true, 0)))
+        } RETRY(true);
+    }
+    cout << "Loaded " << MERGE_NUM_KEYS << " keys into RW" << endl;
+
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < MERGE_WORKERS; i++)
+        workers.push_back(std::thread(lookup_worker, &hART, i + 1));
+    // thread id MERGE_WORKERS + 1 is the merge thread's
+    for(unsigned w = 0; w < MERGE_WRITERS; w++)
+        workers.push_back(std::thread(write_worker, &hART, w, MERGE_WORKERS + 2 + w));
+
+    // sample lookup throughput before, during and after the merge
+    std::vector<double> before, during, after;
+    auto sample = [] () {
+        uint64_t prev = lookups_done.load();
+        usleep(MERGE_SAMPLE_MS * 1000);
+        return (lookups_done.load() - prev) * 1000.0 / MERGE_SAMPLE_MS;
+    };
+    for(int i = 0; i < 20; i++)
+        before.push_back(sample());
+    hART.start_background_merge(MERGE_WORKERS + 1, MERGE_BATCH);
+    while(hART.is_merging())
+        during.push_back(sample());
+    hART.wait_merge();
+    for(int i = 0; i < 20; i++)
+        after.push_back(sample());
+    workers_stop = true;
+    for(auto& w : workers)
+        w.join();
 
-    #if BLOOM_TYPE == 0
-    HybridART<uint64_t, DoubleLookup> hART(loadKey, loadKeyTART);
-    #elif BLOOM_TYPE == 1
-    HybridART<uint64_t, BloomNoPacking> hART(loadKey, loadKeyTART);
-    #elif BLOOM_TYPE == 2
-    HybridART<uint64_t, BloomPacking> hART(loadKey, loadKeyTART);
-    #endif
+    auto avg = [] (const std::vector<double>& v) {
+        double sum = 0;
+        for(double x : v)
+            sum += x;
+        return v.empty() ? 0 : sum / v.size();
+    };
+    double min_during = during.empty() ? 0 : *std::min_element(during.begin(), during.end());
+    const merge_stats& ms = hART.last_merge_stats();
+    cout << "Merge: " << ms.keys << " keys in " << ms.batches << " batches, "
+         << ms.aborts << " batch aborts, " << ms.duration_ms << " ms" << endl;
+    cout << "Lookup throughput (ops/sec): before " << avg(before)
+         << ", during " << avg(during) << " (min " << min_during << ")"
+         << ", after " << avg(after) << endl;
+    cout << "Updates committed and verified: " << writes_done.load() << endl;
+    if(avg(before) > 0)
+        cout << "Throughput dip during merge: "
+             << 100.0 * (1 - min_during / avg(before)) << "% at worst" << endl;
+    std::size_t bloom_keys;
+    uint64_t bloom_gen = hART.bloom_generation(&bloom_keys);
+    cout << "Bloom generation " << bloom_gen << ", sized for " << bloom_keys << " keys" << endl;
 
+    // initial load of the RO tree: per-key inserts vs. bulk build
+    std::vector<TID> sorted_tids;
+    for(uint64_t i = 1; i <= MERGE_NUM_KEYS; i++)
+        sorted_tids.push_back(i);
+    auto load_start = std::chrono::steady_clock::now();
+    {
+        ART_OLC::Tree tree(loadKey);
+        auto t = tree.getThreadInfo();
+        for(TID tid : sorted_tids){
+            Key key;
+            loadKey(tid, key);
+            tree.insert(key, tid, t);
+        }
+    }
+    auto load_end = std::chrono::steady_clock::now();
+    bool bulk_ok = hART.bulkLoadRO(sorted_tids.data(), sorted_tids.size());
+    auto bulk_end = std::chrono::steady_clock::now();
+    always_assert(bulk_ok);
+    cout << "RO load of " << MERGE_NUM_KEYS << " keys: per-key insert "
+         << std::chrono::duration<double, std::milli>(load_end - load_start).count()
+         << " ms, bulk build "
+         << std::chrono::duration<double, std::milli>(bulk_end - load_end).count()
+         << " ms" << endl;
+    Transaction::print_stats();
 }
@@ -43,6 +43,7 @@ const unsigned ops_per_thread=20000000;
 #define HIT_RATIO_MOD 2
 
 #define REMOVE 1
+// 0: DoubleLookup, 1: BloomNoPacking, 2: BloomPacking, 3: BloomSplitBlock
 #define BLOOM 0
 
 #include "Zipfian_generator.hh"
@@ -144,6 +145,8 @@ ExtendedART<uint64_t, DoubleLookup> eART(loadKeyTART);
 ExtendedART<uint64_t, BloomNoPacking> eART(loadKeyTART);
 #elif BLOOM == 2
 ExtendedART<uint64_t, BloomPacking> eART(loadKeyTART);
+#elif BLOOM == 3
+ExtendedART<uint64_t, BloomSplitBlock> eART(loadKeyTART);
 #endif
 
 
@@ -569,7 +572,15 @@ void run_bench(uint64_t num_keys, unsigned insert_ratio, unsigned ops_per_txn, u
                 total_txns += txns_info_arr[i][0];
             }
         }
-        #if BLOOM == 1 && MEASURE_BF_FALSE_POSITIVES == 1
+        #if BLOOM > 0
+        {
+            uint64_t bloom_epochs = 0;
+            uint64_t epochs = eART.adaptive_epochs(&bloom_epochs);
+            if(epochs > 0)
+                cout<<"Adaptive lookup policy: "<<bloom_epochs<<" of "<<epochs<<" epochs used the bloom filter\n";
+        }
+        #endif
+        #if BLOOM > 0 && MEASURE_BF_FALSE_POSITIVES == 1
             auto FPs = eART.BF_false_positives;
             int BF_FPs=0, BF_accesses=0;
             for(unsigned i=0; i<N_THREADS; i++){
@@ -582,6 +593,7 @@ void run_bench(uint64_t num_keys, unsigned insert_ratio, unsigned ops_per_txn, u
             cout<<"False positive ratio: "<<std::setprecision(4)<< (double) BF_FPs / BF_accesses<<endl; 
         #endif
         printf("%s,%ld,%ld,%f (time:%ldsec)\n", (lookups_only? "lookup txn" : "lookup/insert txn" ),  num_ops, total_txns, (total_txns * 1.0) / duration.count(), duration.count()/1000000);
+        key_arena::print_report(stdout);
         #if STO_PROFILE_COUNTERS && MEASURE_ABORTS == 1
         Transaction::print_stats();
         unsigned long long aborts_total;
@@ -898,6 +910,30 @@ uint64_t read_keys_from_file(string file_name, uint64_t key_offset, bool init){
     return keys_read;
 }
 
+#if BLOOM > 0
+// Builds a standalone filter of the benchmarked type over keys [1, num_keys]
+// and probes it with the `num_absent` keys that follow, which were never
+// inserted: every hit is a false positive.
+template <typename BloomT>
+void bloom_probe_bench(uint64_t num_keys, uint64_t num_absent){
+    if(num_absent == 0)
+        return;
+    BloomT* bf = new BloomT();
+    for(uint64_t i=1; i<=num_keys; i++)
+        bf->insert((const uint8_t*) key_dat[i-1], strlen(key_dat[i-1]));
+    uint64_t FPs = 0;
+    uint64_t hashVal[2];
+    auto starttime = std::chrono::steady_clock::now();
+    for(uint64_t i=num_keys+1; i<=num_keys+num_absent; i++)
+        FPs += bf->contains((const uint8_t*) key_dat[i-1], strlen(key_dat[i-1]), hashVal);
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - starttime);
+    cout<<"Bloom probe: "<<num_absent<<" absent keys, false positive ratio: "<<std::setprecision(4)
+        <<(double) FPs / num_absent<<", "<<(double) duration.count() / num_absent<<" ns/probe"<<endl;
+    delete bf;
+}
+#endif
+
 int main(int argc, char **argv) {
 	char init_files [256];
 	char exec_files [256];
@@ -919,6 +955,7 @@ int main(int argc, char **argv) {
         {"skew-inserts", required_argument, NULL, 's'},
         {"skew-lookups", required_argument, NULL, 'l'},
 		{"multithreaded", no_argument, NULL, 'm'},
+        {"lookup-policy", required_argument, NULL, 'p'},
         {NULL, 0, NULL, 0}
 	};
 
@@ -933,7 +970,7 @@ int main(int argc, char **argv) {
     bzero(latencies_txn_prep, (2*N_THREADS)* sizeof(double));
     #endif
 
-	while((c = getopt_long(argc, argv, ":f:e:r:i:x:t:sm", long_opt, NULL)) != -1){
+	while((c = getopt_long(argc, argv, ":f:e:r:i:x:t:smp:", long_opt, NULL)) != -1){
 		switch (c){
 			case 'f':
 				sprintf(init_files, optarg);
@@ -963,6 +1000,18 @@ int main(int argc, char **argv) {
 			case 'm':
 				multithreaded = true;
 				break;
+            case 'p':
+                if(strcmp(optarg, "bloom") == 0)
+                    eART.set_lookup_policy(lookup_policy::bloom);
+                else if(strcmp(optarg, "double") == 0)
+                    eART.set_lookup_policy(lookup_policy::double_lookup);
+                else if(strcmp(optarg, "adaptive") == 0)
+                    eART.set_lookup_policy(lookup_policy::adaptive);
+                else {
+                    fprintf(stderr, "lookup policy must be bloom, double or adaptive\n");
+                    exit(-1);
+                }
+                break;
 			case ':':
 				error(optopt);
 				break;
@@ -1017,6 +1066,13 @@ int main(int argc, char **argv) {
     }
     cout<<"Running bench with insert ratio "<< insert_ratio <<endl;
     run_bench(init_keys_read, insert_ratio, ops_per_txn, init_keys_read+1, multithreaded);
+    #if BLOOM == 1
+    bloom_probe_bench<BloomNoPacking>(init_keys_read, exec_keys_read);
+    #elif BLOOM == 2
+    bloom_probe_bench<BloomPacking>(init_keys_read, exec_keys_read);
+    #elif BLOOM == 3
+    bloom_probe_bench<BloomSplitBlock>(init_keys_read, exec_keys_read);
+    #endif
     #if MEASURE_KEY_ACCESSES == 1
     uint64_t rw_lookups=0, ro_lookups=0, off_lookups=0, rw_inserts=0, ro_inserts=0, off_inserts=0;
     double lookup_freq=0, insert_freq=0; // count the average frequency of key accesses
@@ -4,7 +4,9 @@
 #include "MassTrans.hh"
 #include <cassert>
 
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <thread>
 
 // unit testing with key range 0000000-9999999
@@ -13,6 +15,7 @@
 // concurrent thread inserts keys to maintain this invariant
 
 typedef MassTrans<std::string> mbta_type;
+typedef MassTrans<std::string, versioned_value_struct<std::string>, false> mbta_nonopaque_type;
 
 void scanner(mbta_type* mbta) {
     TThread::set_id(0);
@@ -72,6 +75,161 @@ void inserter(mbta_type* mbta) {
     }
 }
 
+#if MASSTRANS_RANGE_VALIDATION
+// the keys a query returns, in order
+template <typename Query>
+std::string scan_keys(Query query) {
+    std::string keys;
+    query([&] (Masstree::Str key, mbta_type::value_type&) {
+        keys += std::string(key.s, key.len) + " ";
+        return true;
+    });
+    return keys;
+}
+
+// Range queries on a table without opacity only conflict with inserts
+// inside the range they scanned, even though all these keys share a leaf.
+void testRangePhantoms() {
+    mbta_nonopaque_type mbta;
+    TThread::set_id(0);
+    mbta.thread_init();
+    for (auto k : {"k10", "k20", "k30", "k40"})
+        mbta.nontransPut(k, std::string(k) + "v");
+
+    // forward, [k10, k30)
+    auto fwd = [&] (std::function<bool(Masstree::Str, mbta_type::value_type&)> cb) {
+        mbta.transQuery("k10", "k30", cb);
+    };
+    {
+        TestTransaction t1(0);
+        assert(scan_keys(fwd) == "k10 k20 ");
+        TestTransaction t2(1);
+        mbta.transInsert(std::string("k35"), std::string("k35v"));
+        assert(t2.try_commit());
+        t1.use();
+        assert(t1.try_commit());
+    }
+    {
+        TestTransaction t1(0);
+        assert(scan_keys(fwd) == "k10 k20 ");
+        TestTransaction t2(1);
+        mbta.transInsert(std::string("k15"), std::string("k15v"));
+        assert(t2.try_commit());
+        t1.use();
+        assert(!t1.try_commit());
+    }
+
+    // reverse, (k10, k20]
+    auto rev = [&] (std::function<bool(Masstree::Str, mbta_type::value_type&)> cb) {
+        mbta.transRQuery("k20", "k10", cb);
+    };
+    {
+        TestTransaction t1(0);
+        assert(scan_keys(rev) == "k20 k15 ");
+        TestTransaction t2(1);
+        mbta.transInsert(std::string("k05"), std::string("k05v"));
+        assert(t2.try_commit());
+        t1.use();
+        assert(t1.try_commit());
+    }
+    {
+        TestTransaction t1(0);
+        assert(scan_keys(rev) == "k20 k15 ");
+        TestTransaction t2(1);
+        mbta.transDelete(std::string("k15"));
+        assert(t2.try_commit());
+        t1.use();
+        assert(!t1.try_commit());
+    }
+
+    // a query that stops early covers only what it saw
+    {
+        TestTransaction t1(0);
+        int n = 0;
+        mbta.transQuery("k20", Masstree::Str(), [&] (Masstree::Str, mbta_type::value_type&) {
+            return ++n < 2;
+        });
+        assert(n == 2);
+        TestTransaction t2(1);
+        mbta.transInsert(std::string("k50"), std::string("k50v"));
+        assert(t2.try_commit());
+        t1.use();
+        assert(t1.try_commit());
+    }
+
+    // our own inserts in the range don't conflict with our scan
+    {
+        TestTransaction t1(0);
+        assert(scan_keys(fwd) == "k10 k20 ");
+        mbta.transInsert(std::string("k25"), std::string("k25v"));
+        assert(t1.try_commit());
+    }
+    std::cout << "testRangePhantoms pass" << std::endl;
+}
+#endif
+
+// A scanner queries [k10, k30) twice per transaction while another thread
+// inserts keys inside or outside that range. Committed transactions must
+// see the same keys both times, and an opaque table must never show a
+// running transaction two different answers. Inserts outside the range
+// must not abort queries that are validated by rescanning.
+template <typename T>
+void testRangeInsertConcurrent(bool opaque, bool inside) {
+    T mbta;
+    TThread::set_id(0);
+    mbta.thread_init();
+    for (auto k : {"k10", "k20", "k30", "k40"})
+        mbta.nontransPut(k, std::string(k) + "v");
+
+    const int ninserts = 1000;
+    std::atomic<bool> done(false);
+    std::thread ins([&] {
+        TThread::set_id(1);
+        mbta.thread_init();
+        for (int i = 0; i < ninserts; ++i) {
+            std::stringstream ss;
+            ss << (inside ? "k2" : "k5") << std::setw(4) << std::setfill('0') << i;
+            TRANSACTION {
+                mbta.transInsert(ss.str(), ss.str() + "v");
+            } RETRY(true);
+        }
+        done = true;
+    });
+
+    unsigned long last = 0, attempts = 0, commits = 0;
+    auto count = [&] () {
+        unsigned long n = 0;
+        mbta.transQuery("k10", "k30", [&] (Masstree::Str, typename T::value_type&) {
+            ++n;
+            return true;
+        });
+        return n;
+    };
+    while (!done) {
+        unsigned long n1, n2;
+        TRANSACTION {
+            ++attempts;
+            n1 = count();
+            n2 = count();
+            assert(!opaque || n1 == n2);
+        } RETRY(true);
+        ++commits;
+        assert(n1 == n2 && n1 >= last);
+        last = n1;
+    }
+    ins.join();
+
+    TRANSACTION {
+        last = count();
+    } RETRY(false);
+    assert(last == 2 + (inside ? ninserts : 0));
+    if (!inside && T::range_rescan)
+        assert(attempts == commits);
+    std::cout << "testRangeInsertConcurrent(" << (opaque ? "opaque" : "nonopaque")
+              << ", " << (inside ? "inside" : "outside") << ") pass: "
+              << commits << " commits, " << attempts - commits << " aborts" << std::endl;
+}
+
 int main() {
     mbta_type mbta;
 
@@ -80,5 +238,12 @@ int main() {
     //scn.join();
     //ins.join();
     //std::cout << "Test pass." << std::endl;
+#if MASSTRANS_RANGE_VALIDATION
+    testRangePhantoms();
+#endif
+    for (bool inside : {false, true}) {
+        testRangeInsertConcurrent<mbta_type>(true, inside);
+        testRangeInsertConcurrent<mbta_nonopaque_type>(false, inside);
+    }
     return 0;
 }
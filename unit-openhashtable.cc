@@ -0,0 +1,254 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <thread>
+#include "Transaction.hh"
+#include "OpenHashtable.hh"
+#include "TBox.hh"
+
+typedef OpenHashtable<int, int> table_type;
+
+// every key hashes to the same bucket, so keys are displaced down one
+// long probe path
+struct CollidingHash {
+    size_t operator()(int) const {
+        return 42;
+    }
+};
+typedef OpenHashtable<int, int, true, 129, int, CollidingHash> colliding_type;
+
+void testSimpleInt() {
+    table_type h(100);
+
+    {
+        TransactionGuard t;
+        assert(h.transInsert(1, 100));
+        assert(!h.transInsert(1, 200));
+        h.transPut(2, 200);
+    }
+
+    {
+        TransactionGuard t2;
+        int v;
+        assert(h.transGet(1, v) && v == 100);
+        assert(h.transGet(2, v) && v == 200);
+        assert(!h.transGet(3, v));
+        assert(h.transUpdate(2, 201));
+        assert(!h.transUpdate(3, 300));
+    }
+
+    {
+        TransactionGuard t3;
+        int v;
+        assert(h.transGet(2, v) && v == 201);
+        assert(h.transDelete(1));
+        assert(!h.transGet(1, v));
+        assert(!h.transDelete(1));
+    }
+
+    int v;
+    assert(!h.read(1, v));
+    assert(h.read(2, v) && v == 201);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAbsentConflict() {
+    table_type h(100);
+    TBox<int> box;
+
+    {
+        TestTransaction t1(1);
+        int v;
+        assert(!h.transGet(5, v));
+        box = 1; /* avoid read-only txn */
+
+        TestTransaction t2(2);
+        assert(h.transInsert(5, 50));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testDeleteConflict() {
+    table_type h(100);
+    TBox<int> box;
+    h.nontrans_insert(5, 50);
+
+    {
+        TestTransaction t1(1);
+        int v;
+        assert(h.transGet(5, v) && v == 50);
+        box = 1;
+
+        TestTransaction t2(2);
+        assert(h.transDelete(5));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        TransactionGuard t;
+        int v;
+        assert(!h.transGet(5, v));
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testOwnWrites() {
+    table_type h(100);
+    h.nontrans_insert(7, 70);
+
+    {
+        TransactionGuard t;
+        int v;
+        // our own insert, deleted again
+        assert(h.transInsert(8, 80));
+        assert(h.transGet(8, v) && v == 80);
+        assert(h.transDelete(8));
+        assert(!h.transGet(8, v));
+        // delete then insert is an update
+        assert(h.transDelete(7));
+        assert(h.transInsert(7, 71));
+        assert(h.transGet(7, v) && v == 71);
+    }
+
+    int v;
+    assert(!h.read(8, v));
+    assert(h.read(7, v) && v == 71);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Deletes leave tombstones in the middle of a probe path: keys behind
+// them must stay reachable, absent keys must still be found absent, and
+// later inserts must reuse the tombstones.
+void testCollisions() {
+    const int n = 40;
+    colliding_type h(2 * n);
+
+    {
+        TransactionGuard t;
+        for (int i = 0; i < n; ++i)
+            assert(h.transInsert(i, i * 10));
+    }
+    {
+        TransactionGuard t;
+        for (int i = 0; i < n; i += 3)
+            assert(h.transDelete(i));
+    }
+    {
+        TransactionGuard t;
+        int v;
+        for (int i = 0; i < n; ++i) {
+            if (i % 3 == 0)
+                assert(!h.transGet(i, v));
+            else
+                assert(h.transGet(i, v) && v == i * 10);
+        }
+        assert(!h.transGet(n, v));
+    }
+    // more inserts than the table has slots: they only fit by reusing
+    // tombstones (the table aborts the program when it is full)
+    for (int round = 0; round < 8; ++round) {
+        {
+            TransactionGuard t;
+            for (int i = 0; i < n; i += 3)
+                assert(h.transInsert(n + i, round));
+        }
+        {
+            TransactionGuard t;
+            for (int i = 0; i < n; i += 3)
+                assert(h.transDelete(n + i));
+        }
+    }
+    {
+        TransactionGuard t;
+        int v;
+        for (int i = 1; i < n; i += 3)
+            assert(h.transGet(i, v) && v == i * 10);
+        for (int i = 0; i < n; i += 3)
+            assert(!h.transGet(n + i, v));
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Tokens move between key k and key k + nkeys: each move deletes one key
+// and inserts the other, so slots are destroyed and claimed while other
+// threads read them. Readers check that the values always sum to the
+// same total.
+void testConcurrentMoves() {
+    const int nkeys = 64, nthreads = 4, nmoves = 20000;
+    table_type h(4 * nkeys);
+    long total = 0;
+    for (int k = 0; k < nkeys; ++k) {
+        h.nontrans_insert(k, k + 1);
+        total += k + 1;
+    }
+
+    auto mover = [&] (int id) {
+        TThread::set_id(id);
+        unsigned seed = id + 1;
+        for (int i = 0; i < nmoves; ++i) {
+            seed = seed * 1103515245 + 12345;
+            int k = (seed >> 8) % nkeys;
+            TRANSACTION {
+                int v;
+                if (h.transGet(k, v)) {
+                    h.transDelete(k);
+                    h.transInsert(k + nkeys, v);
+                } else {
+                    always_assert(h.transGet(k + nkeys, v));
+                    h.transDelete(k + nkeys);
+                    h.transInsert(k, v);
+                }
+            } RETRY(true);
+        }
+    };
+    auto reader = [&] (int id) {
+        TThread::set_id(id);
+        for (int i = 0; i < nmoves / 10; ++i) {
+            long sum;
+            TRANSACTION {
+                sum = 0;
+                for (int k = 0; k < 2 * nkeys; ++k) {
+                    int v;
+                    if (h.transGet(k, v))
+                        sum += v;
+                }
+            } RETRY(true);
+            always_assert(sum == total);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nthreads; ++i)
+        threads.emplace_back(mover, i);
+    threads.emplace_back(reader, nthreads);
+    for (auto& t : threads)
+        t.join();
+
+    TThread::set_id(0);
+    long sum = 0;
+    for (int k = 0; k < 2 * nkeys; ++k) {
+        int v;
+        if (h.read(k, v))
+            sum += v;
+    }
+    assert(sum == total);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSimpleInt();
+    testAbsentConflict();
+    testDeleteConflict();
+    testOwnWrites();
+    testCollisions();
+    testConcurrentMoves();
+    return 0;
+}
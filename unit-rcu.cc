@@ -39,13 +39,15 @@ void* tracker_run(void* argument) {
 static const Clp_Option options[] = {
     { "delay", 'd', 'd', Clp_ValDouble, Clp_Negate },
     { "nthreads", 'j', 'j', Clp_ValInt, 0 },
-    { "nepochs", 'e', 'e', Clp_ValInt, 0 }
+    { "nepochs", 'e', 'e', Clp_ValInt, 0 },
+    { "cooperative", 'c', 'c', 0, Clp_Negate }
 };
 
 int main(int argc, char* argv[]) {
     unsigned nthreads = 4;
     TRcuSet::epoch_type nepochs = 10;
     delay = 0.000001;
+    bool cooperative = false;
 
     Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
     int opt;
@@ -60,6 +62,9 @@ int main(int argc, char* argv[]) {
         case 'e':
             nepochs = clp->val.i;
             break;
+        case 'c':
+            cooperative = !clp->negated;
+            break;
         default:
             abort();
         }
@@ -74,9 +79,15 @@ int main(int argc, char* argv[]) {
     pthread_t tids[nthreads];
     for (uintptr_t i = 0; i < nthreads; ++i)
         pthread_create(&tids[i], NULL, tracker_run, reinterpret_cast<void*>(i));
-    pthread_t advancer;
-    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
-    pthread_detach(advancer);
+    if (cooperative) {
+        // no advancer thread: transactions advance the epoch themselves
+        Transaction::epoch_config.interval_us = 1000;
+        Transaction::epoch_config.cooperative = true;
+    } else {
+        pthread_t advancer;
+        pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+        pthread_detach(advancer);
+    }
 
     while (Transaction::global_epochs.global_epoch < nepochs + 1)
         usleep(useconds_t(delay * 1e6));
@@ -86,6 +97,10 @@ int main(int argc, char* argv[]) {
         pthread_join(tids[i], NULL);
 
     auto nfreed_before = nfreed;
+    auto rs = Transaction::rcu_stats();
+    assert(rs.npending == nallocated - nfreed_before);
+    assert(rs.nreclaimed == nfreed_before);
+    assert(rs.bytes_pending == rs.npending * sizeof(Tracker));
     for (unsigned i = 0; i < nthreads; ++i)
         Transaction::tinfo[i].rcu_set.~TRcuSet();
 
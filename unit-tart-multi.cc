@@ -0,0 +1,176 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "Transaction.hh"
+#include "TART.hh"
+
+// Checks TART::t_multi_lookup against t_lookup, for batches shorter and
+// longer than the interleaving group and the internal batch, mixing
+// present keys, absent keys and the transaction's own writes.
+// `unit-tart-multi --bench` instead times lookups by batch size.
+
+std::vector<std::string> keys;
+
+void loadKeyTART(TID tid, Key& key){
+    TID actual_tid = TART<long>::getTIDFromRec(tid);
+    key.set(keys[actual_tid-1].data(), keys[actual_tid-1].size());
+}
+
+static void make_key(Key& k, const std::string& s){
+    k.set(s.data(), s.size());
+}
+
+// Looks up probes[0..n) both ways in the current transaction and checks
+// that they agree.
+static void check_batch(TART<long>& tart, ThreadInfo& ti, const std::vector<Key*>& probes){
+    std::vector<TID> got(probes.size() + 1, TID(-1));
+    assert(tart.t_multi_lookup(probes.data(), probes.size(), got.data(), ti));
+    assert(got[probes.size()] == TID(-1));
+    for(size_t i = 0; i < probes.size(); i++){
+        auto r = tart.t_lookup(*probes[i], ti);
+        assert(std::get<1>(r));
+        assert(got[i] == std::get<0>(r));
+    }
+}
+
+void testMultiLookupMatchesLookup(){
+    TART<long> tart(loadKeyTART);
+    auto ti = tart.getThreadInfo();
+    char buf[32];
+    // the keys with odd tids are inserted; the rest stay absent, some next
+    // to a present key, some inside a shared prefix
+    for(int i = 0; i < 3000; i++){
+        if(i % 3 == 0)
+            snprintf(buf, sizeof(buf), "LONGCOMMONPREFIX1234%04d", i);
+        else if(i % 3 == 1)
+            snprintf(buf, sizeof(buf), "K%07d", i * 7);
+        else
+            snprintf(buf, sizeof(buf), "S%04dxxxxxxxxxxxxxxxxxxx", i);
+        keys.push_back(buf);
+    }
+    std::vector<Key> all(keys.size());
+    for(size_t i = 0; i < keys.size(); i++)
+        make_key(all[i], keys[i]);
+    {
+        TransactionGuard t;
+        for(TID tid = 1; tid <= keys.size(); tid += 2)
+            assert(std::get<1>(tart.t_insert(all[tid-1], tid, ti)));
+    }
+
+    std::mt19937 rng(1);
+    for(size_t n : {0, 1, 7, 8, 9, 63, 64, 65, 200, 1000}){
+        std::vector<Key*> probes;
+        for(size_t i = 0; i < n; i++)
+            probes.push_back(&all[rng() % all.size()]);
+        {
+            TransactionGuard t;
+            check_batch(tart, ti, probes);
+        }
+        // with the transaction's own insert and remove, then abandoned
+        if(n >= 3){
+            TestTransaction t(0);
+            TID inserted = 2, removed = 3;
+            assert(std::get<1>(tart.t_insert(all[inserted-1], inserted, ti)));
+            assert(std::get<1>(tart.t_remove(all[removed-1], removed, ti)));
+            probes[0] = &all[inserted-1];
+            probes[n / 2] = &all[removed-1];
+            probes[n - 1] = &all[0];
+            check_batch(tart, ti, probes);
+        }
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// A key that another transaction's write makes stale fails our commit,
+// as with t_lookup.
+void testMultiLookupConflict(){
+    TART<long> tart(loadKeyTART);
+    auto ti = tart.getThreadInfo();
+    Key k1, k2;
+    make_key(k1, keys[0]);
+    make_key(k2, keys[1]);
+    {
+        TransactionGuard t;
+        assert(std::get<1>(tart.t_insert(k1, 1, ti)));
+    }
+    {
+        TestTransaction t1(1);
+        const Key* probes[] = {&k1, &k2};
+        TID res[2];
+        assert(tart.t_multi_lookup(probes, 2, res, ti));
+        assert(res[0] == 1 && res[1] == 0);
+        assert(std::get<1>(tart.t_insert(k1, 1, ti)));
+
+        TestTransaction t2(2);
+        assert(std::get<1>(tart.t_insert(k2, 2, ti)));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Lookups per second of t_lookup and of t_multi_lookup by batch size,
+// for random keys, TransactionGuard per 1024 lookups.
+void benchBatchSizes(){
+    const size_t nkeys = 1 << 20, nlookups = 1 << 22, per_txn = 1024;
+    TART<long> tart(loadKeyTART);
+    auto ti = tart.getThreadInfo();
+    keys.clear();
+    std::mt19937_64 rng(2);
+    char buf[32];
+    for(size_t i = 0; i < nkeys; i++){
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) rng());
+        keys.push_back(buf);
+    }
+    std::vector<Key> all(nkeys);
+    for(size_t i = 0; i < nkeys; i++)
+        make_key(all[i], keys[i]);
+    for(size_t i = 0; i < nkeys; i += per_txn){
+        TransactionGuard t;
+        for(size_t j = i; j < std::min(nkeys, i + per_txn); j++)
+            tart.t_insert(all[j], j + 1, ti);
+    }
+    std::vector<const Key*> probes(nlookups);
+    for(auto& p : probes)
+        p = &all[rng() % nkeys];
+    std::vector<TID> res(per_txn);
+
+    // batch 0: one t_lookup per key
+    auto run = [&] (size_t batch) {
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < nlookups; i += per_txn){
+            TransactionGuard t;
+            if(batch == 0)
+                for(size_t j = 0; j < per_txn; j++)
+                    res[j] = std::get<0>(tart.t_lookup(*probes[i + j], ti));
+            else
+                for(size_t j = 0; j < per_txn; j += batch)
+                    tart.t_multi_lookup(&probes[i + j], std::min(batch, per_txn - j), &res[j], ti);
+        }
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+        return nlookups / d.count();
+    };
+    printf("t_lookup: %.2f Mlookups/s\n", run(0) / 1e6);
+    for(size_t batch : {1, 2, 4, 8, 16, 32, 64, 128, 1024})
+        printf("t_multi_lookup batch %4zu: %.2f Mlookups/s\n", batch, run(batch) / 1e6);
+}
+
+int main(int argc, char* argv[]){
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0){
+        benchBatchSizes();
+        return 0;
+    }
+    testMultiLookupMatchesLookup();
+    testMultiLookupConflict();
+    printf("TART multi-lookup tests pass\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "Transaction.hh"
+#include "TART.hh"
+
+// Checks TART::t_scan against a std::map of the same keys, over bounds
+// that end inside compressed node prefixes (both shorter and longer than
+// maxStoredPrefixLength), between key groups and outside the key set, in
+// both directions and with offset and limit.
+
+std::vector<std::string> keys;
+
+void loadKeyTART(TID tid, Key& key){
+    TID actual_tid = TART<long>::getTIDFromRec(tid);
+    key.set(keys[actual_tid-1].data(), keys[actual_tid-1].size());
+}
+
+static void make_key(Key& k, const std::string& s){
+    k.set(s.data(), s.size());
+}
+
+// All keys are 24 bytes long, so none is a prefix of another.
+static void make_keys(){
+    char buf[32];
+    // a 20-byte prefix shared by every key in the group, longer than the
+    // prefix ART stores in the node
+    for(int i = 0; i < 200; i++){
+        snprintf(buf, sizeof(buf), "LONGCOMMONPREFIX1234%04d", i);
+        keys.push_back(buf);
+    }
+    // leaves the group above after 16 bytes
+    for(int i = 0; i < 50; i++){
+        snprintf(buf, sizeof(buf), "LONGCOMMONPREFIX9%07d", i * 3);
+        keys.push_back(buf);
+    }
+    // short prefixes, long shared suffixes
+    for(int i = 0; i < 100; i++){
+        snprintf(buf, sizeof(buf), "S%03dxxxxxxxxxxxxxxxxxxxx", i * 7);
+        keys.push_back(buf);
+    }
+}
+
+static std::vector<TID> expected(const std::map<std::string, TID>& model, const std::string& lo,
+                                 const std::string& hi, bool reverse, size_t offset, size_t limit){
+    std::vector<TID> res;
+    if(lo >= hi)
+        return res;
+    auto b = model.lower_bound(lo), e = model.lower_bound(hi);
+    std::vector<TID> all;
+    for(auto it = b; it != e; ++it)
+        all.push_back(it->second);
+    if(reverse)
+        std::reverse(all.begin(), all.end());
+    for(size_t i = offset; i < all.size() && res.size() < limit; i++)
+        res.push_back(all[i]);
+    return res;
+}
+
+void testScanRanges(){
+    TART<long> tart(loadKeyTART);
+    auto ti = tart.getThreadInfo();
+    std::map<std::string, TID> model;
+    make_keys();
+    {
+        TransactionGuard t;
+        for(TID tid = 1; tid <= keys.size(); tid++){
+            Key k;
+            make_key(k, keys[tid-1]);
+            assert(std::get<1>(tart.t_insert(k, tid, ti)));
+            model[keys[tid-1]] = tid;
+        }
+    }
+
+    std::vector<std::string> bounds = {
+        "", "A", "LONGCOMMONPREFIX", "LONGCOMMONPREFIW", "LONGCOMMONPREFIX0",
+        "LONGCOMMONPREFIX12", "LONGCOMMONPREFIX1234", "LONGCOMMONPREFIX12340050",
+        "LONGCOMMONPREFIX123400505", "LONGCOMMONPREFIX1234015", "LONGCOMMONPREFIX1235",
+        "LONGCOMMONPREFIX2", "LONGCOMMONPREFIX9", "LONGCOMMONPREFIX90000030",
+        "LONGCOMMONPREFIX9000004", "M", "S", "S007", "S007xxxxxxxxxxxxxxxxxxxx",
+        "S008", "S350xxxxxxxxxxxy", "S700", "Z", "\xff"
+    };
+    size_t nscans = 0;
+    for(auto& lo : bounds)
+        for(auto& hi : bounds)
+            for(int reverse = 0; reverse < 2; reverse++)
+                for(size_t offset : {0, 3})
+                    for(size_t limit : {SIZE_MAX, size_t(5)}){
+                        TransactionGuard t;
+                        Key klo, khi;
+                        make_key(klo, lo);
+                        make_key(khi, hi);
+                        std::vector<TID> got;
+                        {
+                            auto c = tart.t_scan(klo, khi, ti, reverse, offset, limit);
+                            while(c.next()){
+                                Key k;
+                                c.load_key(k);
+                                assert(std::string((const char*)&k[0], k.getKeyLen()) == keys[c.value()-1]);
+                                got.push_back(c.value());
+                            }
+                            assert(!c.aborted());
+                        }
+                        assert(got == expected(model, lo, hi, reverse, offset, limit));
+                        ++nscans;
+                    }
+
+    printf("PASS: %s (%zu scans)\n", __FUNCTION__, nscans);
+}
+
+// A record the scanning transaction deleted is not yielded.
+void testScanOwnWrites(){
+    TART<long> tart(loadKeyTART);
+    auto ti = tart.getThreadInfo();
+    {
+        TransactionGuard t;
+        for(TID tid = 1; tid <= 100; tid++){
+            Key k;
+            make_key(k, keys[tid-1]);
+            assert(std::get<1>(tart.t_insert(k, tid, ti)));
+        }
+    }
+    {
+        TransactionGuard t;
+        Key k, lo, hi;
+        make_key(k, keys[9]);
+        assert(std::get<1>(tart.t_remove(k, 10, ti)));
+        make_key(lo, keys[0]);
+        make_key(hi, keys[20]);
+        std::vector<TID> got;
+        {
+            auto c = tart.t_scan(lo, hi, ti);
+            while(c.next())
+                got.push_back(c.value());
+            assert(!c.aborted());
+        }
+        assert(got.size() == 19);
+        assert(std::find(got.begin(), got.end(), 10) == got.end());
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main(){
+    testScanRanges();
+    testScanOwnWrites();
+    printf("TART scan tests pass\n");
+    return 0;
+}
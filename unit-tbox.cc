@@ -1,5 +1,6 @@
 #undef NDEBUG
 #include <string>
+#include <string.h>
 #include <iostream>
 #include <assert.h>
 #include <vector>
@@ -245,6 +246,86 @@ void testStringWrapper() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+#if STO_ABORT_ATTRIBUTION
+static uint64_t abort_count(int threadid, const TObject* owner, const char* reason) {
+    uint64_t n = 0;
+    Transaction::tinfo[threadid].aborts_.for_each([&] (const abort_table::entry& e) {
+            if (e.owner == owner && strcmp(e.reason, reason) == 0)
+                n += e.count;
+        });
+    return n;
+}
+
+void testAbortAttribution() {
+    TBox<int> ib;
+    TBox<int> box;
+    Transaction::clear_stats();
+
+    for (int i = 0; i != 2; ++i) {
+        TestTransaction t1(1);
+        int x = ib;
+        box = x;
+
+        TestTransaction t2(2);
+        ib = i;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(abort_count(1, &ib, "commit check") == 2);
+    assert(abort_count(1, &box, "commit check") == 0);
+
+    {
+        TestTransaction t1(1);
+        try {
+            Sto::abort_because(Sto::item(&box, 0).item(), "test abort");
+            assert(false);
+        } catch (Transaction::Abort e) {
+        }
+    }
+    assert(abort_count(1, &box, "test abort") == 1);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// A hot cause stays counted however many cold causes pass through the
+// table, every abort is still counted once, and reset empties the table.
+void testAbortTableEviction() {
+    TBox<int> box;
+    abort_table at;
+    for (int i = 0; i != 100; ++i)
+        at.account(&box, 0, "hot");
+    for (uint64_t b = 1; b <= 10000; ++b)
+        at.account(&box, b, "cold");
+    at.account(&box, 0, "hot");
+
+    uint64_t total = 0, hot = 0;
+    unsigned n = 0;
+    at.for_each([&] (const abort_table::entry& e) {
+            total += e.count;
+            if (strcmp(e.reason, "hot") == 0)
+                hot = e.count;
+            ++n;
+        });
+    assert(total == 10101);
+    assert(hot >= 101);
+    assert(n <= abort_table::capacity);
+    assert(at.nevicted() > 0);
+
+    at.reset();
+    n = 0;
+    at.for_each([&] (const abort_table::entry&) { ++n; });
+    assert(n == 0 && at.nevicted() == 0);
+    at.account(&box, 7, "after reset");
+    at.for_each([&] (const abort_table::entry& e) {
+            assert(e.bucket == 7 && e.count == 1);
+            ++n;
+        });
+    assert(n == 1);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+#endif
+
 int main() {
     testSimpleInt();
     testSimpleString();
@@ -252,5 +333,9 @@ int main() {
     testOpacity1();
     testNoOpacity1();
     testStringWrapper();
+#if STO_ABORT_ATTRIBUTION
+    testAbortAttribution();
+    testAbortTableEviction();
+#endif
     return 0;
 }
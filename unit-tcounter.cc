@@ -394,6 +394,22 @@ void testNoOpacity() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+// Every thread can hold a TCommutativeVersion's read lock at once without
+// the holder count spilling into the version.
+void testAllThreadsHoldLock() {
+    TCommutativeVersion v(TransactionTid::increment_value * 5);
+    for (int i = 0; i != TransactionTid::max_threads; ++i)
+        v.lock();
+    assert(v.is_locked());
+    assert(v.num_locks() == unsigned(TransactionTid::max_threads));
+    assert(v.unlocked() == TransactionTid::increment_value * 5);
+    for (int i = 0; i != TransactionTid::max_threads; ++i)
+        v.unlock();
+    assert(!v.is_locked());
+    assert(v.value() == TransactionTid::increment_value * 5);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testTrivial();
     testConcurrentUpdate();
@@ -403,5 +419,6 @@ int main() {
     testUpdateRead();
     testOpacity();
     testNoOpacity();
+    testAllThreadsHoldLock();
     return 0;
 }
@@ -132,10 +132,43 @@ void testVariableSizes() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testLargeTransaction() {
+    // many more items than the initial tset index holds, and more than
+    // the tset's former 32768-item limit
+    TGeneric g;
+    const int n = 100000;
+    std::vector<int> f(n, 0);
+
+    {
+        TransactionGuard t;
+        for (int i = 0; i < n; ++i)
+            g.write(&f[i], i);
+        for (int i = 0; i < n; i += 3)
+            g.write(&f[i], g.read(&f[i]) + 1);
+        for (int i = 0; i < n; ++i)
+            assert(g.read(&f[i]) == i + (i % 3 == 0));
+    }
+
+    for (int i = 0; i < n; ++i)
+        assert(f[i] == i + (i % 3 == 0));
+
+    {
+        TransactionGuard t;
+        for (int i = n - 1; i >= 0; --i)
+            g.write(&f[i], g.read(&f[i]) * 2);
+    }
+
+    for (int i = 0; i < n; ++i)
+        assert(f[i] == 2 * (i + (i % 3 == 0)));
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testOpacity1();
     testNoOpacity1();
     testVariableSizes();
+    testLargeTransaction();
     return 0;
 }